@@ -0,0 +1,85 @@
+#ifndef MOMO_BENCH_H
+#define MOMO_BENCH_H
+
+#include <stdint.h>
+#include <dirent.h>
+
+#include "common.h"
+
+/*
+  Timing and reporting helpers shared by the benchmark tools
+*/
+
+// sleeps until the given CLOCK_MONOTONIC timestamp (nanoseconds)
+void sleepUntilNs(uint64_t deadlineNs) {
+  struct timespec deadline = {deadlineNs / 1000000000ull,
+      deadlineNs % 1000000000ull};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL)
+      == EINTR) {
+  }
+}
+
+int compareSamples(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+// p-th percentile (0 < p <= 100) of an ascending array of samples
+uint64_t percentile(uint64_t sorted[], int count, double p) {
+  int index = ceil(p / 100.0 * count) - 1;
+
+  if (count == 0) {
+    return 0;
+  }
+  if (index < 0) {
+    index = 0;
+  }
+
+  return sorted[index];
+}
+
+// Sorts the latency samples (nanoseconds) and prints one summary line in
+// microseconds: p50, p99, p99.9 and max
+void printLatencySummary(char *label, uint64_t samples[], int count) {
+  qsort(samples, count, sizeof(uint64_t), compareSamples);
+
+  printf("%-24s n=%-8d p50=%10.1f p99=%10.1f p99.9=%10.1f max=%10.1f us\n",
+      label, count,
+      percentile(samples, count, 50) / 1000.0,
+      percentile(samples, count, 99) / 1000.0,
+      percentile(samples, count, 99.9) / 1000.0,
+      percentile(samples, count, 100) / 1000.0);
+  fflush(stdout);
+}
+
+// Removes the scratch directory, its tmp/ and logs/ and their files
+void removeScratchDir(char *path) {
+  char *subdirs[] = {"tmp", "logs"};
+  char filePath[PATH_MAX];
+
+  for (int i = 0; i < 2; i++) {
+    DIR *dir;
+    struct dirent *entry;
+
+    snprintf(filePath, sizeof(filePath), "%s/%s", path, subdirs[i]);
+    dir = opendir(filePath);
+    if (dir == NULL) {
+      continue;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+      if (entry->d_name[0] != '.') {
+        snprintf(filePath, sizeof(filePath), "%s/%s/%s", path, subdirs[i],
+            entry->d_name);
+        unlink(filePath);
+      }
+    }
+    closedir(dir);
+    snprintf(filePath, sizeof(filePath), "%s/%s", path, subdirs[i]);
+    rmdir(filePath);
+  }
+
+  rmdir(path);
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef MOMO_CHECKPOINT_H
+#define MOMO_CHECKPOINT_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "common.h"
+#include "cmdring.h"
+
+/*
+  Crash-consistent motor state checkpoint, mapped from tmp/checkpoint_<axis>.
+  The motor commits its state (position, velocity, commands consumed from
+  each lane of its command ring) after every change, without any syscall:
+  the new state is written into the record that is NOT current, then the
+  commit counter is bumped, which atomically makes it current. A motor killed
+  at any point (EMERGENCY STOP, crash) therefore always leaves one complete
+  record behind, and its replacement resumes from it as soon as it maps the
+  file. The page cache keeps the file across process deaths; a checksum
+  guards the records against anything worse.
+  Readers (the other motor, momo-control) copy a record out while the motor
+  keeps committing: the commit counter works as a seqlock, and a copy made
+  while it moved is made again.
+*/
+
+struct checkpointRecord {
+  float position;
+  float currentSpeed;
+  uint32_t ringSession; // command ring the lane counters refer to
+  uint32_t laneTails[CMD_LANES]; // commands consumed from each lane
+  uint32_t checksum;
+};
+
+struct motorCheckpoint {
+  _Atomic uint32_t commits; // records[commits & 1] is the current one
+  struct checkpointRecord records[2];
+};
+
+// FNV-1a of the record, checksum excluded
+uint32_t checkpointChecksum(struct checkpointRecord *record) {
+  unsigned char *bytes = (unsigned char *) record;
+  uint32_t hash = 2166136261u;
+
+  for (int i = 0; i < offsetof(struct checkpointRecord, checksum); i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+
+  return hash;
+}
+
+// Maps the checkpoint of the given axis (creating an empty one if needed)
+struct motorCheckpoint *openCheckpoint(char *axis) {
+  struct motorCheckpoint *checkpoint;
+  char fileName[32] = "tmp/checkpoint_";
+  struct stat info;
+  int fd;
+
+  strcat(fileName, axis); // e.g. checkpoint_x
+
+  fd = open(fileName, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (fd == -1 || fstat(fd, &info) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("checkpoint.h open");
+    writeErrorLog(fdlog_err, "checkpoint.h: openCheckpoint open failed");
+    exit(-1);
+  }
+  if (info.st_size != sizeof(struct motorCheckpoint) &&
+      (ftruncate(fd, 0) == -1 ||
+       ftruncate(fd, sizeof(struct motorCheckpoint)) == -1)) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("checkpoint.h ftruncate");
+    writeErrorLog(fdlog_err, "checkpoint.h: openCheckpoint ftruncate failed");
+    exit(-1);
+  }
+
+  checkpoint = mmap(NULL, sizeof(struct motorCheckpoint),
+      PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (checkpoint == MAP_FAILED) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("checkpoint.h mmap");
+    writeErrorLog(fdlog_err, "checkpoint.h: openCheckpoint mmap failed");
+    exit(-1);
+  }
+  close(fd);
+
+  return checkpoint;
+}
+
+// Copies the latest complete record into copy
+// Returns false if there is none (never committed, or both records damaged)
+bool readCheckpoint(struct motorCheckpoint *checkpoint,
+    struct checkpointRecord *copy) {
+  while (1) {
+    uint32_t commits = atomic_load_explicit(&checkpoint->commits,
+        memory_order_acquire);
+    bool isFound = false;
+
+    // (the previous record is the one being rewritten: only its checksum
+    // tells whether it is whole)
+    for (int i = 0; i < 2 && commits - i > 0 && !isFound; i++) {
+      memcpy(copy, &checkpoint->records[(commits - i) & 1],
+          sizeof(struct checkpointRecord));
+      isFound = copy->checksum == checkpointChecksum(copy);
+    }
+
+    // a record is rewritten two commits after it became current: the copy
+    // only holds if no commit happened while it was made
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&checkpoint->commits, memory_order_relaxed) ==
+        commits) {
+      return isFound;
+    }
+  }
+}
+
+// Commits the motor state: only ever overwrites the non-current record
+void commitCheckpoint(struct motorCheckpoint *checkpoint, float position,
+    float currentSpeed, struct cmdChannel *commands) {
+  uint32_t commits = atomic_load_explicit(&checkpoint->commits,
+      memory_order_relaxed);
+  struct checkpointRecord *record = &checkpoint->records[(commits + 1) & 1];
+
+  record->position = position;
+  record->currentSpeed = currentSpeed;
+  record->ringSession = commands->ring->session;
+  readCmdRingTails(commands, record->laneTails);
+  record->checksum = checkpointChecksum(record);
+
+  atomic_store_explicit(&checkpoint->commits, commits + 1,
+      memory_order_release);
+}
+
+#endif
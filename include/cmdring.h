@@ -0,0 +1,352 @@
+#ifndef MOMO_CMDRING_H
+#define MOMO_CMDRING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "common.h"
+
+/*
+  Shared-memory command ring between the command modules (commander,
+  inspector, momo-loadgen, momo-control) and the motors. Every axis has its
+  own ring, mapped from tmp/cmdring_<axis>, made of one
+  single-producer/single-consumer lane per producer process. Producers
+  publish commands with plain atomic stores, no syscall involved, each
+  stamped with a ring-wide sequence number; the motor drains every lane once
+  per tick, merging the lanes in publishing order, and only frees the slots
+  it read once its checkpoint records them (see checkpoint.h), so that a
+  restarted motor can read again what its predecessor had not committed.
+  Urgent commands (RESET, STOP, SHUTDOWN) also bump a futex word, so that a
+  sleeping motor wakes up immediately instead of at its next tick deadline.
+*/
+
+// special velocity commands (see README)
+#define CMD_RESET 500
+#define CMD_STOP 501
+#define CMD_SHUTDOWN 502
+
+// producer lanes: each producer process owns exactly one lane
+#define CMD_LANE_COMMANDER 0
+#define CMD_LANE_INSPECTOR 1
+#define CMD_LANE_LOADGEN 2
+#define CMD_LANE_CONTROL 3
+#define CMD_LANES 4
+// commands per lane (must be a power of two)
+#define CMD_RING_SLOTS 256
+
+struct cmdLane {
+  _Atomic uint32_t head; // next slot to write, only moved by the producer
+  _Atomic uint32_t isProducerWaiting; // producer sleeps on tail (lane full)
+  char padHead[56];
+  _Atomic uint32_t tail; // next slot to read, only moved by the motor
+  char padTail[60];
+  float commands[CMD_RING_SLOTS];
+  uint32_t sequences[CMD_RING_SLOTS]; // publishing order across the lanes
+};
+
+struct cmdRing {
+  _Atomic uint32_t wakeup; // futex word the motor sleeps on
+  uint32_t session; // changes every time the ring is reset
+  char pad[56];
+  _Atomic uint32_t sequence; // next sequence number, taken by the producers
+  char padSequence[60];
+  struct cmdLane lanes[CMD_LANES];
+};
+
+// process-local handle on a command ring
+struct cmdChannel {
+  struct cmdRing *ring;
+  int fd; // kept open: its shared flock marks the ring as in use
+  int lane; // producer lane, -1 for the motor
+  int laneFd; // producer: its exclusive flock claims the lane
+  uint32_t tails[CMD_LANES]; // motor: read so far, freed by releaseCommands()
+};
+
+long futex(_Atomic uint32_t *word, int op, uint32_t value,
+    const struct timespec *timeout, uint32_t value3) {
+  return syscall(SYS_futex, word, op, value, timeout, NULL, value3);
+}
+
+void mapCmdRing(struct cmdChannel *channel) {
+  channel->ring = mmap(NULL, sizeof(struct cmdRing), PROT_READ | PROT_WRITE,
+      MAP_SHARED, channel->fd, 0);
+  if (channel->ring == MAP_FAILED) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("cmdring.h mmap");
+    writeErrorLog(fdlog_err, "cmdring.h: openCmdRing mmap failed");
+    exit(-1);
+  }
+}
+
+// Maps the command ring of the given axis. The first process to open a ring
+// (nobody else holding it) starts from an empty ring, just like the kernel
+// buffer of a pipe nobody has open.
+void openCmdRing(struct cmdChannel *channel, char *axis, int lane) {
+  char ringName[32] = "tmp/cmdring_";
+  char lockName[40];
+  int lockFd;
+  strcat(ringName, axis); // e.g. cmdring_x
+  snprintf(lockName, sizeof(lockName), "%s.lock", ringName);
+
+  channel->lane = lane;
+  channel->ring = NULL;
+  channel->fd = open(ringName, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  // one opener at a time: turning the exclusive lock into a shared one is
+  // not atomic, and another opener getting the exclusive lock in between
+  // would reset the ring again
+  lockFd = open(lockName, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (channel->fd == -1 || lockFd == -1 || flock(lockFd, LOCK_EX) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("cmdring.h open");
+    writeErrorLog(fdlog_err, "cmdring.h: openCmdRing open failed");
+    exit(-1);
+  }
+
+  if (flock(channel->fd, LOCK_EX | LOCK_NB) == 0) {
+    // nobody else is using the ring: throw away stale commands
+    if (ftruncate(channel->fd, 0) == -1 ||
+        ftruncate(channel->fd, sizeof(struct cmdRing)) == -1) {
+      printf("Error %d in ", errno);
+      fflush(stdout);
+      perror("cmdring.h ftruncate");
+      writeErrorLog(fdlog_err, "cmdring.h: openCmdRing ftruncate failed");
+      exit(-1);
+    }
+    mapCmdRing(channel);
+    channel->ring->session = (uint32_t) (nowNs() ^ getpid());
+  }
+  flock(channel->fd, LOCK_SH);
+  close(lockFd);
+
+  if (channel->ring == NULL) {
+    mapCmdRing(channel);
+  }
+  for (int i = 0; i < CMD_LANES; i++) {
+    channel->tails[i] = atomic_load_explicit(&channel->ring->lanes[i].tail,
+        memory_order_relaxed);
+  }
+}
+
+void closeCmdRing(struct cmdChannel *channel) {
+  if (munmap(channel->ring, sizeof(struct cmdRing)) == -1 ||
+      close(channel->fd) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("cmdring.h close");
+    writeErrorLog(fdlog_err, "cmdring.h: closeCmdRing failed");
+    exit(-1);
+  }
+}
+
+bool isUrgentCommand(float command) {
+  int code = round(command);
+  return code == CMD_RESET || code == CMD_STOP || code == CMD_SHUTDOWN;
+}
+
+// Wakes the motor if it is sleeping until its next tick
+void wakeMotor(struct cmdRing *ring) {
+  atomic_fetch_add_explicit(&ring->wakeup, 1, memory_order_release);
+  futex(&ring->wakeup, FUTEX_WAKE, INT_MAX, NULL, 0);
+}
+
+// Publishes a command on the channel's lane, unless the lane is full
+// Returns false if the lane was full (the command was not published)
+bool tryPublishCommand(struct cmdChannel *channel, float command) {
+  struct cmdLane *lane = &channel->ring->lanes[channel->lane];
+  uint32_t head = atomic_load_explicit(&lane->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&lane->tail, memory_order_acquire);
+
+  if (head - tail >= CMD_RING_SLOTS) {
+    return false;
+  }
+
+  lane->commands[head & (CMD_RING_SLOTS - 1)] = command;
+  lane->sequences[head & (CMD_RING_SLOTS - 1)] = atomic_fetch_add_explicit(
+      &channel->ring->sequence, 1, memory_order_relaxed);
+  atomic_store_explicit(&lane->head, head + 1, memory_order_release);
+
+  if (isUrgentCommand(command)) {
+    wakeMotor(channel->ring);
+  }
+
+  return true;
+}
+
+// Free slots in the channel's lane (at least: the motor may drain more)
+uint32_t cmdLaneSpace(struct cmdChannel *channel) {
+  struct cmdLane *lane = &channel->ring->lanes[channel->lane];
+  uint32_t head = atomic_load_explicit(&lane->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&lane->tail, memory_order_acquire);
+
+  return CMD_RING_SLOTS - (head - tail);
+}
+
+// Publishes a batch of commands with a single head update and at most one
+// wakeup. Returns false (publishing nothing) if they do not all fit
+bool tryPublishCommands(struct cmdChannel *channel, float commands[],
+    int count) {
+  struct cmdLane *lane = &channel->ring->lanes[channel->lane];
+  uint32_t head = atomic_load_explicit(&lane->head, memory_order_relaxed);
+  bool isUrgent = false;
+  uint32_t sequence;
+
+  if (count > cmdLaneSpace(channel)) {
+    return false;
+  }
+
+  sequence = atomic_fetch_add_explicit(&channel->ring->sequence, count,
+      memory_order_relaxed);
+  for (int i = 0; i < count; i++) {
+    lane->commands[(head + i) & (CMD_RING_SLOTS - 1)] = commands[i];
+    lane->sequences[(head + i) & (CMD_RING_SLOTS - 1)] = sequence + i;
+    isUrgent = isUrgent || isUrgentCommand(commands[i]);
+  }
+  atomic_store_explicit(&lane->head, head + count, memory_order_release);
+
+  if (isUrgent) {
+    wakeMotor(channel->ring);
+  }
+
+  return true;
+}
+
+// Lane full: has the motor drain it now, and sleeps until it has (or for at
+// most one tick, or until a signal arrives)
+void waitForLane(struct cmdChannel *channel) {
+  struct cmdLane *lane = &channel->ring->lanes[channel->lane];
+  struct timespec timeout = {getSimSpeed() / 1000000,
+      getSimSpeed() % 1000000 * 1000};
+  uint32_t tail = atomic_load_explicit(&lane->tail, memory_order_acquire);
+
+  atomic_store_explicit(&lane->isProducerWaiting, 1, memory_order_seq_cst);
+  wakeMotor(channel->ring);
+  futex(&lane->tail, FUTEX_WAIT, tail, &timeout, 0);
+}
+
+// Publishes a command on the channel's lane. Only blocks (like a full pipe
+// would) when the motor has not drained the lane for CMD_RING_SLOTS commands.
+void publishCommand(struct cmdChannel *channel, float command) {
+  while (!tryPublishCommand(channel, command)) {
+    waitForLane(channel);
+  }
+}
+
+// Current value of the motor's futex word: read it BEFORE draining the ring,
+// then hand it to waitCmdRing() so that no wakeup is missed in between
+uint32_t cmdRingWakeup(struct cmdChannel *channel) {
+  return atomic_load_explicit(&channel->ring->wakeup, memory_order_acquire);
+}
+
+// Drains every lane into commands[] (at most maxCommands), in the order the
+// commands were published across the lanes: a STOP is never overtaken by a
+// command another producer published after it
+// The slots stay taken until releaseCommands()
+// Returns the number of commands read
+int readCommands(struct cmdChannel *channel, float commands[],
+    int maxCommands) {
+  uint32_t heads[CMD_LANES];
+  int count = 0;
+
+  for (int i = 0; i < CMD_LANES; i++) {
+    heads[i] = atomic_load_explicit(&channel->ring->lanes[i].head,
+        memory_order_acquire);
+  }
+
+  while (count < maxCommands) {
+    int next = -1;
+    uint32_t nextSequence = 0;
+
+    for (int i = 0; i < CMD_LANES; i++) {
+      if (channel->tails[i] == heads[i]) {
+        continue;
+      }
+      uint32_t sequence = channel->ring->lanes[i].sequences[channel->tails[i] &
+          (CMD_RING_SLOTS - 1)];
+      // (wrap-around comparison)
+      if (next == -1 || (int32_t) (sequence - nextSequence) < 0) {
+        next = i;
+        nextSequence = sequence;
+      }
+    }
+    if (next == -1) {
+      break;
+    }
+
+    commands[count++] = channel->ring->lanes[next].commands[
+        channel->tails[next] & (CMD_RING_SLOTS - 1)];
+    channel->tails[next]++;
+  }
+
+  return count;
+}
+
+// Frees the slots of the commands read so far, waking producers that wait
+// for them: call it once the checkpoint records them
+void releaseCommands(struct cmdChannel *channel) {
+  for (int i = 0; i < CMD_LANES; i++) {
+    struct cmdLane *lane = &channel->ring->lanes[i];
+
+    if (atomic_load_explicit(&lane->tail, memory_order_relaxed) ==
+        channel->tails[i]) {
+      continue;
+    }
+    atomic_store_explicit(&lane->tail, channel->tails[i],
+        memory_order_seq_cst);
+
+    if (atomic_load_explicit(&lane->isProducerWaiting, memory_order_seq_cst)) {
+      atomic_store_explicit(&lane->isProducerWaiting, 0, memory_order_relaxed);
+      futex(&lane->tail, FUTEX_WAKE, INT_MAX, NULL, 0);
+    }
+  }
+}
+
+// Copies how many commands the motor read so far from each lane
+void readCmdRingTails(struct cmdChannel *channel, uint32_t tails[CMD_LANES]) {
+  memcpy(tails, channel->tails, sizeof(channel->tails));
+}
+
+// Moves the motor's read position of each lane to tails[], as committed by
+// its predecessor: the commands it had read but not committed are read again.
+// Its slots were not freed, so no producer can have reused them; lanes whose
+// tails[] is out of place (not between the freed slots and the head) are left
+// untouched.
+void resumeCmdRing(struct cmdChannel *channel, uint32_t tails[CMD_LANES]) {
+  for (int i = 0; i < CMD_LANES; i++) {
+    struct cmdLane *lane = &channel->ring->lanes[i];
+    uint32_t head = atomic_load_explicit(&lane->head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&lane->tail, memory_order_relaxed);
+
+    // (unsigned arithmetic: tails[i] must lie in [tail, head])
+    if (tails[i] - tail <= head - tail) {
+      channel->tails[i] = tails[i];
+    }
+  }
+}
+
+// Sleeps until the absolute CLOCK_MONOTONIC deadline, or until a producer
+// wakes the motor up. Returns true if woken up before the deadline.
+bool waitCmdRing(struct cmdChannel *channel, uint32_t wakeup,
+    struct timespec *deadline) {
+  long retval = futex(&channel->ring->wakeup, FUTEX_WAIT_BITSET, wakeup,
+      deadline, FUTEX_BITSET_MATCH_ANY);
+
+  if (retval == -1 && errno == ETIMEDOUT) {
+    return false;
+  } else if (retval == -1 && errno != EAGAIN && errno != EINTR) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("cmdring.h futex wait");
+    writeErrorLog(fdlog_err, "cmdring.h: waitCmdRing futex failed");
+    exit(-1);
+  }
+
+  return true;
+}
+
+#endif
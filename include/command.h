@@ -1,4 +1,9 @@
-#include "../include/common.h"
+#ifndef MOMO_COMMAND_H
+#define MOMO_COMMAND_H
+
+#include "common.h"
+#include "cmdring.h"
+#include "uring.h"
 
 /*
   Header file for all command modules (commander, inspector)
@@ -28,53 +33,59 @@ int detectKeyPress () {
   return input;
 }
 
-// Writes to pipe the speed and axis specified
-void commandMotor (int fd, float speed) {
-  if (write(fd, &speed, sizeof(speed)) == -1) {
-    printf("Error %d in ", errno);
-    fflush(stdout);
-    perror("command.h motorcomm write");
-    writeErrorLog(fdlog_err, "command.h: commandMotor write failed");
-    exit(-1);
+// Publishes the speed to the motor's command ring
+void commandMotor (struct cmdChannel *channel, float speed) {
+  uint64_t traceStart = traceBegin();
+
+  publishCommand(channel, speed);
+  traceEnd("command publish", traceStart);
+
+  if (stats != NULL) {
+    countStat(&stats->commands, 1);
   }
 }
 
-// Creates and opens the COMMANDER pipe
-int openPipeMotorComm(char *axis) {
-  int fd;
-  char pipeName[32] = "tmp/motorcommands_";
-  strcat(pipeName, axis); // e.g. motorcommands_x
+// The SIGUSR1 handlers of the commander and the inspector publish on the
+// lane of their main loop, and a lane has a single producer: the main loop
+// blocks the signal (isBlocking) while it publishes, so that no handler runs
+// in the middle of a publish
+void blockCommandSignal(bool isBlocking) {
+  sigset_t signals;
 
-  // (ignore "file already exists", errno 17)
-  if (mkfifo(pipeName, 0666) == -1 && errno != 17) {
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+  sigprocmask(isBlocking ? SIG_BLOCK : SIG_UNBLOCK, &signals, NULL);
+}
+
+// Maps the COMMANDER ring of the motor, publishing on the given lane
+// (CMD_LANE_COMMANDER, CMD_LANE_INSPECTOR, ...). A lane has a single
+// producer: exits if another process publishes on it already
+void openMotorComm(struct cmdChannel *channel, char *axis, int lane) {
+  char lockName[40];
+
+  snprintf(lockName, sizeof(lockName), "tmp/cmdring_%s.lane%d", axis, lane);
+  channel->laneFd = open(lockName, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (channel->laneFd == -1) {
     printf("Error %d in ", errno);
     fflush(stdout);
-    perror("command.h mkfifo");
-    writeErrorLog(fdlog_err, "command.h: openPipeMotorComm mkfifo failed");
+    perror("command.h open");
+    writeErrorLog(fdlog_err, "command.h: openMotorComm open failed");
     exit(-1);
   }
-
-  fd = open(pipeName, O_WRONLY);
-  if (fd == -1) {
-    printf("Error %d in ", errno);
-    fflush(stdout);
-    perror("command.h motorcomm open");
-    writeErrorLog(fdlog_err, "command.h: openPipeMotorComm open failed");
+  if (flock(channel->laneFd, LOCK_EX | LOCK_NB) == -1) {
+    printf("command.h: lane %d of the %s ring is taken by another process\n",
+        lane, axis);
+    writeErrorLog(fdlog_err, "command.h: openMotorComm lane already taken");
     exit(-1);
   }
 
-  return fd;
+  openCmdRing(channel, axis, lane);
 }
 
-// Closes the pipe
-void closePipeMotorComm(int fd) {
-  if (close(fd) == -1) {
-    printf("Error %d in ", errno);
-    fflush(stdout);
-    perror("command.h motorcomm close");
-    writeErrorLog(fdlog_err, "command.h: closePipeMotorComm close failed");
-    exit(-1);
-  }
+// Unmaps the COMMANDER ring, and gives up its lane
+void closeMotorComm(struct cmdChannel *channel) {
+  closeCmdRing(channel);
+  close(channel->laneFd);
 }
 
 // Creates and opens the INSPECTOR pipe
@@ -104,6 +115,25 @@ int openPipeMotorInspector(char *axis) {
   return fd;
 }
 
+// Opens a write end of the pipe that the inspector holds itself, so that
+// its read end never sees end of file while the motors restart
+int holdPipeMotorInspector(char *axis) {
+  int fd;
+  char pipeName[32] = "tmp/motorinspector_";
+  strcat(pipeName, axis);
+
+  fd = open(pipeName, O_WRONLY | O_NONBLOCK);
+  if (fd == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("command.h motorinspector hold");
+    writeErrorLog(fdlog_err, "command.h: holdPipeMotorInspector open failed");
+    exit(-1);
+  }
+
+  return fd;
+}
+
 // Closes the pipe
 void closePipeMotorInspector (int fd) {
   if (close(fd) == -1) {
@@ -128,3 +158,98 @@ float readCoordinates (int fd) {
 
   return coordinate;
 }
+
+// Reads the coordinates already waiting in a non-blocking pipe, up to max
+// Returns how many were read
+int readAvailableCoordinates (int fd, float *coordinates, int max) {
+  ssize_t length = read(fd, coordinates, max * sizeof(float));
+
+  if (length == -1 && errno != EAGAIN && errno != EINTR) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("command.h motorinspector read");
+    writeErrorLog(fdlog_err, "command.h: readAvailableCoordinates read failed");
+    exit(-1);
+  }
+
+  // (the motors write whole floats, which pipes never split)
+  return length > 0 ? length / sizeof(float) : 0;
+}
+
+// io_uring reader of the two INSPECTOR pipes (x, z): a read stays queued on
+// each pipe, and taking the coordinates that arrived re-queues the reads and
+// waits for the next ones in a single system call, where poll() then a
+// read() per pipe take three
+struct coordinateReader {
+  struct uring ring;
+  int fds[2];
+  float coordinates[2][64]; // where the queued reads land
+  bool isQueued[2];
+};
+
+// Sets the reader up on the (blocking) pipes
+// Returns false if io_uring is unavailable: the pipes are then to be polled
+bool openCoordinateReader(struct coordinateReader *reader, int fdx, int fdz) {
+  int ops[] = {IORING_OP_READ};
+
+  if (!openUring(&reader->ring, 4, ops, 1)) {
+    return false;
+  }
+  if (!reader->ring.hasExtArg) {
+    closeUring(&reader->ring);
+    return false;
+  }
+  reader->fds[0] = fdx;
+  reader->fds[1] = fdz;
+  reader->isQueued[0] = false;
+  reader->isQueued[1] = false;
+
+  return true;
+}
+
+// Waits up to timeoutNs for coordinates, then copies those that arrived on
+// each pipe (up to 64) and sets their counts
+// Returns true if any arrived
+bool readCoordinateReader(struct coordinateReader *reader,
+    float coordinates[2][64], int counts[2], uint64_t timeoutNs) {
+  struct io_uring_cqe cqe;
+  bool isRead = false;
+
+  for (int i = 0; i < 2; i++) {
+    counts[i] = 0;
+    if (!reader->isQueued[i]) {
+      struct io_uring_sqe *sqe = getSqe(&reader->ring);
+      sqe->opcode = IORING_OP_READ;
+      sqe->fd = reader->fds[i];
+      sqe->addr = (uintptr_t) reader->coordinates[i];
+      sqe->len = sizeof(reader->coordinates[i]);
+      sqe->off = -1; // (a pipe: no offset)
+      sqe->user_data = i;
+      reader->isQueued[i] = true;
+    }
+  }
+
+  // (a timeout of 0 would wait forever)
+  enterUring(&reader->ring, 1, timeoutNs > 0 ? timeoutNs : 1);
+  while (reapCqe(&reader->ring, &cqe)) {
+    int i = cqe.user_data;
+
+    reader->isQueued[i] = false;
+    if (cqe.res < 0 && cqe.res != -EINTR && cqe.res != -EAGAIN) {
+      errno = -cqe.res;
+      printf("Error %d in ", errno);
+      fflush(stdout);
+      perror("command.h motorinspector read");
+      writeErrorLog(fdlog_err, "command.h: readCoordinateReader read failed");
+      exit(-1);
+    }
+    // (the motors write whole floats, which pipes never split)
+    counts[i] = cqe.res > 0 ? cqe.res / sizeof(float) : 0;
+    memcpy(coordinates[i], reader->coordinates[i], counts[i] * sizeof(float));
+    isRead = isRead || counts[i] > 0;
+  }
+
+  return isRead;
+}
+
+#endif
@@ -1,3 +1,6 @@
+#ifndef MOMO_COMMON_H
+#define MOMO_COMMON_H
+
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -38,6 +41,22 @@ int fdlog_err;
 // used to write to logs
 #define BUFF_SIZE 8192
 
+#include "stats.h"
+#include "trace.h"
+#include "logrotate.h"
+
+// Returns the simulation cycle length in microseconds: SIM_SPEED, unless the
+// MOMO_SIM_SPEED environment variable overrides it (e.g. for benchmarks)
+long getSimSpeed() {
+  char *value = getenv("MOMO_SIM_SPEED");
+
+  if (value != NULL && atol(value) > 0) {
+    return atol(value);
+  }
+
+  return SIM_SPEED;
+}
+
 // Writes PID to a pipe
 void writePID(char* pipeName, bool isClosing) {
   pid_t pid =  getpid();
@@ -135,8 +154,8 @@ void terminalColor(int colorCode, bool isBold) {
     specialCode = "1;";
   }
 
+  // (not flushed: callers flush whole lines or frames)
   printf("\033[%s%dm", specialCode, colorCode);
-  fflush(stdout);
 }
 
 void printIntro(char* consoleName) {
@@ -146,14 +165,13 @@ void printIntro(char* consoleName) {
   printf("Space Hoist Satellite\n");
   terminalColor(35, true);
   printf("\n%s Console\n", consoleName);
-  fflush(stdout);
 }
 
 // opens error log
 int openErrorLog() {
   int fd;
 
-  fd = open("logs/errors.log", O_WRONLY | O_APPEND | O_CREAT, 0666);
+  fd = openLog(LOG_ERRORS);
   if (fd == -1) {
     printf("Error %d in ", errno);
     fflush(stdout);
@@ -168,7 +186,7 @@ int openErrorLog() {
 int openInfoLog() {
   int fd;
 
-  fd = open("logs/info.log", O_WRONLY | O_APPEND | O_CREAT, 0666);
+  fd = openLog(LOG_INFO);
   if (fd == -1) {
     printf("Error %d in ", errno);
     fflush(stdout);
@@ -181,10 +199,13 @@ int openInfoLog() {
 
 // writes to info log
 void writeInfoLog(int fd, char* string) {
+  uint64_t start = nowNs();
+  uint64_t traceStart = traceBegin();
   // get current time
   time_t rawtime;
   struct tm * timeinfo;
-  char* currentTime = malloc(sizeof(timeinfo));
+  char currentTime[64];
+  int length;
   time ( &rawtime );
   timeinfo = localtime ( &rawtime );
 
@@ -194,22 +215,31 @@ void writeInfoLog(int fd, char* string) {
       timeinfo->tm_min, timeinfo->tm_sec);
 
   // make sure print is atomic
-  flock(fd, LOCK_EX);
-  if (dprintf(fd, "%s %s\n", currentTime, string) < 0) {
+  lockLog(fd, LOG_INFO);
+  if ((length = dprintf(fd, "%s %s\n", currentTime, string)) < 0) {
     printf("Error %d in ", errno);
     fflush(stdout);
     perror("common.h writeInfoLog");
     exit(-1);
   }
-  flock(fd, LOCK_UN);
+  unlockLog(fd, LOG_INFO, length);
+
+  if (stats != NULL) {
+    countStat(&stats->logWrites, 1);
+    recordLatency(&stats->logLatency, nowNs() - start);
+  }
+  traceEnd("log write", traceStart);
 }
 
 // writes to error log
 void writeErrorLog(int fd, char* string) {
+  uint64_t start = nowNs();
+  uint64_t traceStart = traceBegin();
   // get current time
   time_t rawtime;
   struct tm * timeinfo;
-  char* currentTime = malloc(sizeof(timeinfo));
+  char currentTime[64];
+  int length;
   time ( &rawtime );
   timeinfo = localtime ( &rawtime );
 
@@ -219,14 +249,20 @@ void writeErrorLog(int fd, char* string) {
       timeinfo->tm_min, timeinfo->tm_sec);
 
   // make sure print is atomic
-  flock(fd, LOCK_EX);
-  if (dprintf(fd, "%s %s\n", currentTime, string) < 0) {
+  lockLog(fd, LOG_ERRORS);
+  if ((length = dprintf(fd, "%s %s\n", currentTime, string)) < 0) {
     printf("Error %d in ", errno);
     fflush(stdout);
     perror("common.h writeErrorLog");
     exit(-1);
   }
-  flock(fd, LOCK_UN);
+  unlockLog(fd, LOG_ERRORS, length);
+
+  if (stats != NULL) {
+    countStat(&stats->logWrites, 1);
+    recordLatency(&stats->logLatency, nowNs() - start);
+  }
+  traceEnd("log write", traceStart);
 }
 
 // closes log defined by fd
@@ -249,3 +285,5 @@ void closePipe(int fd) {
     exit(-1);
   }
 }
+
+#endif
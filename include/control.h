@@ -0,0 +1,62 @@
+#ifndef MOMO_CONTROL_H
+#define MOMO_CONTROL_H
+
+#include <stdint.h>
+
+/*
+  Control socket protocol, served by momo-control on the Unix domain socket
+  tmp/control.sock (SOCK_STREAM). A client writes fixed-size requests, as
+  many as it likes without waiting (pipelining); the server answers every
+  request, in order, with a fixed-size reply carrying the same id. Both are
+  in host byte order (the socket is local).
+  Commands go to the motors' command rings through their own lane,
+  CMD_LANE_CONTROL: a reply with CONTROL_OK means the command is queued for
+  the motor, which applies it at its next tick (or right away for STOP,
+  RESET and SHUTDOWN). CONTROL_BUSY means the lane is full: retry later.
+  The last slots of the lane are kept for STOP, RESET and SHUTDOWN, which
+  are not refused while other requests fill it.
+  Every reply carries the motors' last checkpointed state.
+*/
+
+#define CONTROL_SOCKET "tmp/control.sock"
+
+// request operations
+#define CONTROL_MOVE 1 // add value to the velocity (like the commander keys)
+#define CONTROL_VELOCITY 2 // set the velocity to value
+#define CONTROL_STOP 3
+#define CONTROL_RESET 4
+#define CONTROL_SHUTDOWN 5 // stops the motors for good
+#define CONTROL_QUERY 6 // only reply with the state
+
+// request axis
+#define CONTROL_AXIS_X 0
+#define CONTROL_AXIS_Z 1
+#define CONTROL_AXIS_BOTH 2
+
+// reply status
+#define CONTROL_OK 0
+#define CONTROL_INVALID 1 // unknown operation or axis, value out of range
+#define CONTROL_BUSY 2
+
+// velocities this large would read as special commands (500 to 502)
+#define CONTROL_MAX_VELOCITY 499
+
+struct controlRequest {
+  uint32_t id; // chosen by the client, echoed in the reply
+  uint8_t op;
+  uint8_t axis;
+  uint16_t reserved;
+  float value;
+};
+
+struct controlReply {
+  uint32_t id;
+  uint8_t op;
+  uint8_t status;
+  uint16_t reserved;
+  uint32_t latencyNs; // from reading the request to queueing its commands
+  float position[2]; // x, z
+  float velocity[2];
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef MOMO_ESTIMATOR_H
+#define MOMO_ESTIMATOR_H
+
+#include "common.h"
+
+/*
+  Streaming state estimator for the coordinates the motors publish. Each axis
+  runs a constant-velocity Kalman filter: every sample costs O(1) and yields
+  the filtered position, the estimated velocity (units per motor cycle, like
+  the velocity commands) and the innovation (measurement minus prediction).
+  The innovations are summed up with Welford's algorithm: their mean should
+  stay near 0 and their deviation near sqrt(S), the spread the filter
+  expects; anything else means the noise model does not fit.
+  A velocity command shows up as an innovation far beyond that spread: the
+  velocity uncertainty is then raised to one command step, so the filter
+  follows the new velocity within a few samples instead of averaging it away.
+  The state is stored per field, with one entry per axis, and every axis is
+  stepped at once, without branches, so the update loop vectorizes.
+*/
+
+#define ESTIMATOR_AXES 2
+// variance of the motors' measurement error (uniform, from -0.5 to 0.5)
+#define ESTIMATOR_MEASUREMENT_NOISE (1.0f / 12)
+// variance of the velocity change per cycle, between commands
+#define ESTIMATOR_PROCESS_NOISE 0.0001f
+// innovations beyond this many variances (3 sigma) mean a velocity change
+#define ESTIMATOR_GATE 9.0f
+// velocity variance after a velocity change: one command step
+#define ESTIMATOR_MANEUVER 1.0f
+
+struct stateEstimator {
+  float position[ESTIMATOR_AXES];
+  float velocity[ESTIMATOR_AXES];
+  // covariance of (position, velocity)
+  float p00[ESTIMATOR_AXES];
+  float p01[ESTIMATOR_AXES];
+  float p11[ESTIMATOR_AXES];
+  float innovation[ESTIMATOR_AXES]; // of the latest sample
+  float spread[ESTIMATOR_AXES]; // expected innovation variance (S)
+  float samples[ESTIMATOR_AXES];
+  // Welford statistics of the innovations
+  double count[ESTIMATOR_AXES];
+  double mean[ESTIMATOR_AXES];
+  double m2[ESTIMATOR_AXES];
+};
+
+void initEstimator(struct stateEstimator *estimator) {
+  memset(estimator, 0, sizeof(struct stateEstimator));
+  for (int i = 0; i < ESTIMATOR_AXES; i++) {
+    // unknown position: the first sample is taken as is
+    estimator->p00[i] = 1e6f;
+    estimator->p11[i] = ESTIMATOR_MANEUVER;
+  }
+}
+
+// Advances every axis by one motor cycle and corrects the axes that have a
+// new sample (isMeasured[i]) with it
+void updateEstimator(struct stateEstimator *estimator,
+    float measurements[ESTIMATOR_AXES], bool isMeasured[ESTIMATOR_AXES]) {
+  struct stateEstimator *e = estimator;
+
+  for (int i = 0; i < ESTIMATOR_AXES; i++) {
+    float q = ESTIMATOR_PROCESS_NOISE;
+    float has = isMeasured[i];
+
+    // predict (only the axes that have a sample: the others wait for theirs)
+    e->position[i] += has * e->velocity[i];
+    e->p00[i] += has * (2 * e->p01[i] + e->p11[i] + q / 4);
+    e->p01[i] += has * (e->p11[i] + q / 2);
+    e->p11[i] += has * q;
+
+    // correct
+    float y = measurements[i] - e->position[i];
+    float s = e->p00[i] + ESTIMATOR_MEASUREMENT_NOISE;
+    float isManeuver = has * (e->samples[i] > 0 && y * y > ESTIMATOR_GATE * s);
+    e->p11[i] += isManeuver * ESTIMATOR_MANEUVER;
+    float k0 = has * e->p00[i] / s;
+    float k1 = has * e->p01[i] / s;
+    e->position[i] += k0 * y;
+    e->velocity[i] += k1 * y;
+    e->p11[i] -= k1 * e->p01[i];
+    e->p00[i] -= k0 * e->p00[i];
+    e->p01[i] -= k0 * e->p01[i];
+
+    // innovation statistics (not of the first sample: nothing was predicted)
+    float isCounted = has * (e->samples[i] > 0);
+    e->samples[i] += has;
+    e->innovation[i] = has ? y : e->innovation[i];
+    e->spread[i] = has ? s : e->spread[i];
+    e->count[i] += isCounted;
+    double delta = y - e->mean[i];
+    e->mean[i] += isCounted * delta / (e->count[i] > 0 ? e->count[i] : 1);
+    e->m2[i] += isCounted * delta * (y - e->mean[i]);
+  }
+}
+
+// Standard deviation of the innovations of the axis so far
+float innovationDeviation(struct stateEstimator *estimator, int axis) {
+  double count = estimator->count[axis];
+  return count > 1 ? sqrt(estimator->m2[axis] / (count - 1)) : 0;
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef MOMO_HISTORY_H
+#define MOMO_HISTORY_H
+
+#include "common.h"
+
+/*
+  Position history of an axis, for the inspector's strip charts. Samples are
+  kept in a fixed ring (the last HISTORY_SAMPLES of them), and reduced as they
+  arrive into one min/max pair per chart column: each column covers a fixed
+  slice of time, so drawing a frame only reads the columns, O(width), however
+  many samples they stand for. The columns are rebuilt from the ring only
+  when the chart width changes. All memory is in the structure itself.
+*/
+
+// samples kept per axis (must be a power of two)
+#define HISTORY_SAMPLES 8192
+// widest chart
+#define HISTORY_COLUMNS 512
+
+struct positionHistory {
+  float samples[HISTORY_SAMPLES];
+  uint64_t times[HISTORY_SAMPLES];
+  long count; // samples received so far
+  // min/max of the samples of each column, min > max when it has none
+  float columnMin[HISTORY_COLUMNS];
+  float columnMax[HISTORY_COLUMNS];
+  int width; // columns in use
+  uint64_t columnNs; // time covered by a column
+  uint64_t lastColumn; // absolute number (time / columnNs) of the newest one
+};
+
+void clearColumn(struct positionHistory *history, uint64_t column) {
+  history->columnMin[column % history->width] = INFINITY;
+  history->columnMax[column % history->width] = -INFINITY;
+}
+
+// Moves the chart forward to the column of the given time, emptying the
+// columns skipped (at most the whole chart)
+void advanceHistory(struct positionHistory *history, uint64_t time) {
+  uint64_t column = time / history->columnNs;
+
+  if (column <= history->lastColumn) {
+    return;
+  }
+  if (column - history->lastColumn > history->width) {
+    history->lastColumn = column - history->width;
+  }
+  while (history->lastColumn < column) {
+    clearColumn(history, ++history->lastColumn);
+  }
+}
+
+void binSample(struct positionHistory *history, float sample, uint64_t time) {
+  uint64_t column = time / history->columnNs;
+  int slot;
+
+  advanceHistory(history, time);
+  if (column + history->width <= history->lastColumn) {
+    return; // older than the chart
+  }
+  slot = column % history->width;
+  if (sample < history->columnMin[slot]) {
+    history->columnMin[slot] = sample;
+  }
+  if (sample > history->columnMax[slot]) {
+    history->columnMax[slot] = sample;
+  }
+}
+
+// Sets the chart to width columns covering spanNs, rebuilding the columns
+// from the samples kept
+void setHistoryWidth(struct positionHistory *history, int width,
+    uint64_t spanNs) {
+  long oldest = history->count > HISTORY_SAMPLES ?
+      history->count - HISTORY_SAMPLES : 0;
+
+  width = width < 1 ? 1 : width > HISTORY_COLUMNS ? HISTORY_COLUMNS : width;
+  history->width = width;
+  history->columnNs = spanNs / width > 0 ? spanNs / width : 1;
+  history->lastColumn = 0;
+  for (int i = 0; i < width; i++) {
+    clearColumn(history, i);
+  }
+  for (long i = oldest; i < history->count; i++) {
+    binSample(history, history->samples[i % HISTORY_SAMPLES],
+        history->times[i % HISTORY_SAMPLES]);
+  }
+}
+
+void addHistorySample(struct positionHistory *history, float sample,
+    uint64_t time) {
+  history->samples[history->count % HISTORY_SAMPLES] = sample;
+  history->times[history->count % HISTORY_SAMPLES] = time;
+  history->count++;
+  binSample(history, sample, time);
+}
+
+#endif
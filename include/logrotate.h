@@ -0,0 +1,442 @@
+#ifndef MOMO_LOGROTATE_H
+#define MOMO_LOGROTATE_H
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/stat.h>
+#include <zlib.h>
+
+/*
+  Log rotation shared by all processes. A control page mapped from tmp/logctl
+  counts, for each log, the bytes written to it, when it was created and a
+  generation number. The page outlives the simulation, and the logs may be
+  deleted in between: every process takes the size and creation time of
+  each log from the file itself when it opens it. The writer whose line
+  takes a log past MOMO_LOG_MAX_BYTES (default 64 MB) or MOMO_LOG_MAX_AGE
+  seconds (default one day) renames it, while it still holds its lock, to a
+  segment (e.g. logs/info.log.20261019-093000-000003), creates the new log
+  and bumps the generation; the other writers notice the new generation when
+  they next take the lock and reopen the log on the same descriptor, so
+  nobody stops writing. Segments are gzipped by a detached thread at idle
+  priority and only the newest MOMO_LOG_KEEP (default 8) are kept.
+  Included by common.h.
+*/
+
+#define LOG_INFO 0
+#define LOG_ERRORS 1
+#define LOG_FILES 2
+#define LOG_MAX_BYTES (64 * 1024 * 1024)
+#define LOG_MAX_AGE (24 * 60 * 60)
+#define LOG_KEEP 8
+#define LOG_SEGMENTS_MAX 256
+
+// (glibc only declares it with _GNU_SOURCE)
+#ifndef SCHED_IDLE
+#define SCHED_IDLE 5
+#endif
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#ifndef AT_EMPTY_PATH
+#define AT_EMPTY_PATH 0x1000
+#endif
+
+struct logState {
+  _Atomic uint32_t generation;
+  _Atomic uint64_t bytes; // written to the current log
+  _Atomic int64_t createdAt; // wall clock seconds
+  _Atomic uint64_t inode; // of the current log
+  char pad[32]; // one cache line per log
+};
+
+struct logControl {
+  struct logState logs[LOG_FILES];
+};
+
+char *logPaths[LOG_FILES] = {"logs/info.log", "logs/errors.log"};
+struct logControl *logControl = NULL;
+// generation of the log each descriptor of this process refers to
+uint32_t logGenerations[LOG_FILES];
+long logMaxBytes;
+long logMaxAge;
+int logKeep;
+_Atomic bool isCompressing = false;
+_Atomic int compressRequests = 0;
+
+// Reads a positive setting from the environment
+long getLogSetting(char *name, long fallback) {
+  char *value = getenv(name);
+
+  if (value != NULL && atol(value) > 0) {
+    return atol(value);
+  }
+
+  return fallback;
+}
+
+// Removes the partial .gz of segments nobody is compressing any more (left
+// by a process killed while compressing: the segment is still there and
+// gets compressed again)
+void removePartialSegments() {
+  char path[PATH_MAX];
+  struct dirent *entry;
+  DIR *directory = opendir("logs");
+
+  if (directory == NULL) {
+    return;
+  }
+  while ((entry = readdir(directory)) != NULL) {
+    int length = strlen(entry->d_name);
+    int fd;
+
+    if (length < 8 || strcmp(entry->d_name + length - 8, ".gz.part") != 0) {
+      continue;
+    }
+    // (whoever compresses a segment holds its lock)
+    snprintf(path, sizeof(path), "logs/%.*s", length - 8, entry->d_name);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || flock(fd, LOCK_EX | LOCK_NB) == 0) {
+      snprintf(path, sizeof(path), "logs/%s", entry->d_name);
+      unlink(path);
+    }
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+  closedir(directory);
+}
+
+// Maps the control page (once per process); rotation is disabled if it
+// cannot be mapped
+void openLogControl() {
+  struct stat info;
+  int fd;
+
+  if (logControl != NULL) {
+    return;
+  }
+  logMaxBytes = getLogSetting("MOMO_LOG_MAX_BYTES", LOG_MAX_BYTES);
+  logMaxAge = getLogSetting("MOMO_LOG_MAX_AGE", LOG_MAX_AGE);
+  logKeep = getLogSetting("MOMO_LOG_KEEP", LOG_KEEP);
+
+  fd = open("tmp/logctl", O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (fd == -1 || fstat(fd, &info) == -1 ||
+      (info.st_size < sizeof(struct logControl) &&
+       ftruncate(fd, sizeof(struct logControl)) == -1)) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("logrotate.h openLogControl");
+    if (fd != -1) {
+      close(fd);
+    }
+    return;
+  }
+
+  struct logControl *control = mmap(NULL, sizeof(struct logControl),
+      PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (control == MAP_FAILED) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("logrotate.h mmap");
+    return;
+  }
+
+  logControl = control;
+  removePartialSegments();
+}
+
+// Sets *birth to the creation time of the open file (wall clock seconds)
+// Returns false if the file system does not keep it
+bool fileBirthTime(int fd, int64_t *birth) {
+  struct statx info;
+
+  if (syscall(SYS_statx, fd, "", AT_EMPTY_PATH, STATX_BTIME, &info) == 0 &&
+      (info.stx_mask & STATX_BTIME)) {
+    *birth = info.stx_btime.tv_sec;
+    return true;
+  }
+
+  return false;
+}
+
+// Takes the size and creation time of the open log instead of trusting the
+// control page (without creation times, a log the page was not about is
+// taken as new)
+void syncLogState(int fd, int log) {
+  struct logState *state = &logControl->logs[log];
+  struct stat info;
+  int64_t birth;
+
+  flock(fd, LOCK_EX);
+  if (fstat(fd, &info) == 0) {
+    if (fileBirthTime(fd, &birth)) {
+      atomic_store(&state->createdAt, birth);
+    } else if (atomic_load(&state->inode) != info.st_ino) {
+      atomic_store(&state->createdAt, time(NULL));
+    }
+    atomic_store(&state->inode, info.st_ino);
+    atomic_store(&state->bytes, info.st_size);
+  }
+  flock(fd, LOCK_UN);
+}
+
+// Opens the log for appending, remembering which generation it belongs to
+int openLog(int log) {
+  int fd;
+
+  openLogControl();
+  // read before opening: a rotation in between only causes a spurious reopen
+  if (logControl != NULL) {
+    logGenerations[log] = atomic_load(&logControl->logs[log].generation);
+  }
+
+  fd = open(logPaths[log], O_WRONLY | O_APPEND | O_CREAT, 0666);
+  if (fd != -1 && logControl != NULL) {
+    syncLogState(fd, log);
+  }
+
+  return fd;
+}
+
+// Points fd at the current log (keeping its number, which the callers hold)
+void reopenLog(int fd, int log) {
+  uint32_t generation = atomic_load(&logControl->logs[log].generation);
+  int newFd = open(logPaths[log], O_WRONLY | O_APPEND | O_CREAT, 0666);
+
+  if (newFd == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("logrotate.h reopenLog");
+    // keep writing to the rotated segment rather than losing the line
+    logGenerations[log] = generation;
+    return;
+  }
+
+  // the lock belongs to the open file, which forked processes may share
+  flock(fd, LOCK_UN);
+  dup2(newFd, fd);
+  close(newFd);
+  logGenerations[log] = generation;
+}
+
+// Locks the log for one line, following any rotation done by another process
+void lockLog(int fd, int log) {
+  flock(fd, LOCK_EX);
+  while (logControl != NULL && logGenerations[log] !=
+      atomic_load(&logControl->logs[log].generation)) {
+    reopenLog(fd, log);
+    flock(fd, LOCK_EX);
+  }
+}
+
+// Sets the calling thread to idle CPU and I/O priority
+void setIdlePriority() {
+  struct sched_param param;
+  pid_t tid = syscall(SYS_gettid);
+
+  memset(&param, 0, sizeof(param));
+  if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0) {
+    setpriority(PRIO_PROCESS, tid, 19);
+  }
+  syscall(SYS_ioprio_set, 1, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+}
+
+// Gzips one segment into <segment>.gz, then removes it
+void compressSegment(char *segment) {
+  char compressed[PATH_MAX];
+  char partial[PATH_MAX];
+  char buffer[65536];
+  struct stat info;
+  ssize_t length;
+  int fd;
+
+  fd = open(segment, O_RDONLY | O_CLOEXEC);
+  // another process may be compressing it, or be done with it already
+  if (fd == -1 || flock(fd, LOCK_EX | LOCK_NB) == -1 ||
+      fstat(fd, &info) == -1 || info.st_nlink == 0) {
+    if (fd != -1) {
+      close(fd);
+    }
+    return;
+  }
+
+  snprintf(compressed, sizeof(compressed), "%s.gz", segment);
+  snprintf(partial, sizeof(partial), "%s.gz.part", segment);
+  gzFile out = gzopen(partial, "wb6");
+  if (out == NULL) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("logrotate.h gzopen");
+    close(fd);
+    return;
+  }
+
+  while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+    if (gzwrite(out, buffer, length) != length) {
+      length = -1;
+      break;
+    }
+  }
+
+  if (gzclose(out) != Z_OK || length == -1 ||
+      rename(partial, compressed) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("logrotate.h compressSegment");
+    unlink(partial);
+  } else {
+    unlink(segment);
+  }
+  close(fd);
+}
+
+int compareNames(const void *a, const void *b) {
+  return strcmp(*(char **) a, *(char **) b);
+}
+
+// Compresses the segments of every log, and removes the oldest ones beyond
+// logKeep (segment names sort by creation time)
+void compressSegments() {
+  char path[PATH_MAX];
+  char *kept[LOG_SEGMENTS_MAX];
+
+  for (int log = 0; log < LOG_FILES; log++) {
+    char *name = strrchr(logPaths[log], '/') + 1;
+    int nameLength = strlen(name);
+    int count = 0;
+    struct dirent *entry;
+    DIR *directory = opendir("logs");
+
+    if (directory == NULL) {
+      return;
+    }
+    while ((entry = readdir(directory)) != NULL) {
+      char *suffix = entry->d_name + nameLength;
+      if (strncmp(entry->d_name, name, nameLength) != 0 || *suffix != '.' ||
+          suffix[1] < '0' || suffix[1] > '9' || strstr(suffix, ".part")) {
+        continue;
+      }
+
+      snprintf(path, sizeof(path), "logs/%s", entry->d_name);
+      if (strstr(suffix, ".gz") == NULL) {
+        compressSegment(path);
+        strcat(path, ".gz");
+      }
+      if (count < LOG_SEGMENTS_MAX) {
+        kept[count++] = strdup(path);
+      }
+    }
+    closedir(directory);
+
+    qsort(kept, count, sizeof(char *), compareNames);
+    for (int i = 0; i < count; i++) {
+      if (i < count - logKeep) {
+        unlink(kept[i]);
+      }
+      free(kept[i]);
+    }
+  }
+}
+
+// Background compression: runs until no rotation is left unhandled
+void *compressionThread(void *argument) {
+  setIdlePriority();
+
+  do {
+    while (atomic_exchange(&compressRequests, 0) > 0) {
+      compressSegments();
+    }
+    atomic_store(&isCompressing, false);
+    // a rotation may have come in just before the flag was cleared
+  } while (atomic_load(&compressRequests) > 0 &&
+      !atomic_exchange(&isCompressing, true));
+
+  return NULL;
+}
+
+// Hands the segments to the compression thread, starting it if needed
+void requestCompression() {
+  pthread_attr_t attributes;
+  pthread_t thread;
+
+  atomic_fetch_add(&compressRequests, 1);
+  if (atomic_exchange(&isCompressing, true)) {
+    return;
+  }
+
+  pthread_attr_init(&attributes);
+  pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+  if (pthread_create(&thread, &attributes, compressionThread, NULL) != 0) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("logrotate.h pthread_create");
+    atomic_store(&isCompressing, false);
+  }
+  pthread_attr_destroy(&attributes);
+}
+
+// Renames the log to a new segment and starts a new log
+// Must be called with the log locked
+void rotateLog(int fd, int log) {
+  struct logState *state = &logControl->logs[log];
+  char segment[PATH_MAX];
+  char createdAt[32];
+  struct tm timeinfo;
+  time_t now = time(NULL);
+
+  localtime_r(&now, &timeinfo);
+  strftime(createdAt, sizeof(createdAt), "%Y%m%d-%H%M%S", &timeinfo);
+  snprintf(segment, sizeof(segment), "%s.%s-%06u", logPaths[log], createdAt,
+      logGenerations[log] + 1);
+
+  if (rename(logPaths[log], segment) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("logrotate.h rotateLog");
+    // retry at the next threshold rather than on every line
+    atomic_store(&state->bytes, 0);
+    atomic_store(&state->createdAt, now);
+    return;
+  }
+
+  // the new log must exist before the other writers look for it
+  int newFd = open(logPaths[log], O_WRONLY | O_APPEND | O_CREAT, 0666);
+  struct stat info;
+  atomic_store(&state->bytes, 0);
+  atomic_store(&state->createdAt, now);
+  atomic_store(&state->inode, newFd != -1 && fstat(newFd, &info) == 0 ?
+      info.st_ino : 0);
+  atomic_fetch_add(&state->generation, 1);
+  if (newFd != -1) {
+    flock(fd, LOCK_UN);
+    dup2(newFd, fd);
+    close(newFd);
+    logGenerations[log] += 1;
+  }
+
+  requestCompression();
+}
+
+// Accounts for a line written to the log, rotating it if it is due, then
+// unlocks it
+void unlockLog(int fd, int log, int length) {
+  if (logControl != NULL) {
+    struct logState *state = &logControl->logs[log];
+    uint64_t bytes = atomic_fetch_add(&state->bytes, length) + length;
+
+    if (bytes >= logMaxBytes ||
+        time(NULL) - atomic_load(&state->createdAt) >= logMaxAge) {
+      rotateLog(fd, log);
+    }
+  }
+
+  flock(fd, LOCK_UN);
+}
+
+#endif
@@ -1,31 +1,36 @@
-#include "../include/common.h"
+#ifndef MOMO_MOTOR_H
+#define MOMO_MOTOR_H
+
+#include "common.h"
+#include "cmdring.h"
+#include "checkpoint.h"
+#include "obstacles.h"
+#include "rtprofile.h"
+#include "telemetry.h"
+#include "uring.h"
 
 /*
   Header file for all motors
 */
 
-// Creates and opens the pipes
-// fd[0] commanderPipeName, fd[1] inspectorPipeName
-void activateMotor(int fd[2], char* commanderPipeName, char* inspectorPipeName) {
+// completions of a tick submitted through io_uring
+#define TICK_WRITE 1
+#define TICK_WAIT 2
+#define TICK_TIMEOUT 3
 
-  // COMMANDER pipe
-  // (ignore "file already exists", errno 17)
-  if (mkfifo(commanderPipeName, 0666) == -1 && errno != 17) {
-    printf("Error %d in ", errno);
-    fflush(stdout);
-    perror("motor.h commander mkfifo");
-    writeErrorLog(fdlog_err, "Motor: commanderPipe mkfifo failed");
-    exit(-1);
-  }
+struct motorState {
+  float position;
+  float currentSpeed;
+  int maxAxis;
+  bool isStopped;
+};
 
-  fd[0] = open(commanderPipeName, O_RDONLY);
-  if (fd[0] == -1) {
-    printf("Error %d in ", errno);
-    fflush(stdout);
-    perror("motor.h commander pipe open");
-    writeErrorLog(fdlog_err, "Motor: commanderPipe open failed");
-    exit(-1);
-  }
+// Maps the command ring and opens the INSPECTOR pipe
+void activateMotor(struct cmdChannel *commands, int *fd, char* axis,
+    char* inspectorPipeName) {
+
+  // COMMANDER ring
+  openCmdRing(commands, axis, -1);
 
   // INSPECTOR pipe
   // (ignore "file already exists", errno 17)
@@ -37,8 +42,8 @@ void activateMotor(int fd[2], char* commanderPipeName, char* inspectorPipeName)
     exit(-1);
   }
 
-  fd[1] = open(inspectorPipeName, O_WRONLY);
-  if (fd[1] == -1) {
+  *fd = open(inspectorPipeName, O_WRONLY);
+  if (*fd == -1) {
     printf("Error %d in ", errno);
     fflush(stdout);
     perror("motor.h inspector pipe open");
@@ -47,44 +52,118 @@ void activateMotor(int fd[2], char* commanderPipeName, char* inspectorPipeName)
   }
 }
 
-// Reads speed from pipe sent by commander process
-// If 0 is returned, then that means there was no data to read. Ignore it.
-float readSpeed(int fd) {
-  float speed = 0;
-
-  // for the select()
-  fd_set fdSet;
-  int retval;
-  int maxfd;
-  struct timeval tv;
-  tv.tv_sec = 0;  // we don't want any blocking!
-  tv.tv_usec = 0;
-
-  FD_ZERO(&fdSet);
-  FD_SET(fd, &fdSet);
-  maxfd = fd;
-
-  retval = select(maxfd + 1, &fdSet, NULL, NULL, &tv);
-  if (retval == -1) {
-    printf("Error %d in ", errno);
-    fflush(stdout);
-    perror("motor.h select");
-    writeErrorLog(fdlog_err, "Motor: readSpeed select failed");
-    exit(-1);
-  } else if (retval) {
-    if (FD_ISSET(fd, &fdSet)) {
-      // read speed from pipe
-      read(fd, &speed, sizeof(speed));
-      // if 0 was read, that means it is EOF
-      if (speed == 0) {
-        // EOF
-      }
+// Applies a command received from the command ring to the motor state
+// Returns true if the command was SHUTDOWN
+bool applyCommand(struct motorState *state, float newSpeedStep) {
+  if (round(newSpeedStep) == CMD_SHUTDOWN) {
+    // SHUTDOWN command
+    writeInfoLog(fdlog_info, "Motor: SHUTDOWN command received");
+    return true;
+  } else if (round(newSpeedStep) == CMD_RESET) {
+    // RESET command
+    writeInfoLog(fdlog_info, "Motor: RESET command received");
+    state->currentSpeed = 0;
+    state->position = -state->maxAxis; // FIXME: too sudden of a change
+  } else if (state->isStopped) {
+    // EMERGENCY STOP command has been signalled
+  } else if (round(newSpeedStep) == CMD_STOP) {
+    // NON-EMERGENCY STOP
+    state->currentSpeed = 0;
+    writeInfoLog(fdlog_info, "Motor: stop request received");
+  } else {
+    // normal motor movement
+    state->currentSpeed += newSpeedStep;
+    writeInfoLog(fdlog_info, "Motor: velocity command received");
+  }
+
+  return false;
+}
+
+// Drains the command ring and applies every pending command
+// Returns true if SHUTDOWN was received
+bool applyCommands(struct motorState *state, struct cmdChannel *commands) {
+  float pending[CMD_LANES * CMD_RING_SLOTS];
+  int count = readCommands(commands, pending, CMD_LANES * CMD_RING_SLOTS);
+
+  countStat(&stats->commands, count);
+  setStat(&stats->queueDepth, count);
+  if (count > stats->maxQueueDepth) {
+    setStat(&stats->maxQueueDepth, count);
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (applyCommand(state, pending[i])) {
+      return true;
     }
+  }
+
+  return false;
+}
+
+// Restores the state committed by the previous motor of this axis, if it
+// ran in the same simulation: the command ring outlives a restarted motor
+// (EMERGENCY STOP, crash), not the simulation, so a brand new simulation
+// (whose ring is new) starts from the origin.
+void resumeMotor(struct motorState *state, struct motorCheckpoint *checkpoint,
+    struct cmdChannel *commands) {
+  struct checkpointRecord record;
+
+  if (!readCheckpoint(checkpoint, &record)) {
+    writeInfoLog(fdlog_info, "Motor: no checkpoint, starting from the origin");
+    return;
+  } else if (record.ringSession != commands->ring->session) {
+    writeInfoLog(fdlog_info, "Motor: new simulation, starting from the "
+        "origin");
+    return;
+  }
+
+  state->position = record.position;
+  state->currentSpeed = record.currentSpeed;
+  resumeCmdRing(commands, record.laneTails);
+  writeInfoLog(fdlog_info, "Motor: resumed from checkpoint");
+}
+
+// Step of this tick, shortened near the obstacles (see obstacles.h), whose
+// clearance depends on where the other motor is (from its checkpoint). The
+// two motors step in the same tick, so the step checked is the diagonal one
+// of the hook, with the other motor's speed. The motor is stopped when it
+// reaches OBSTACLE_STOP
+float obstacleStep(struct motorState *state, struct obstacleField *obstacles,
+    struct motorCheckpoint *other, bool isAxisX) {
+  struct checkpointRecord record;
+  float otherPosition = 0;
+  float otherSpeed = 0;
+  float fraction;
+
+  if (obstacles->clearance == NULL || state->currentSpeed == 0) {
+    return state->currentSpeed;
+  }
+
+  if (readCheckpoint(other, &record)) {
+    otherPosition = record.position;
+    otherSpeed = record.currentSpeed;
+  }
+  if (isAxisX) {
+    fraction = obstacleStepFraction(obstacles, state->position, otherPosition,
+        state->currentSpeed, otherSpeed);
   } else {
-    // nothing to read
+    fraction = obstacleStepFraction(obstacles, otherPosition, state->position,
+        otherSpeed, state->currentSpeed);
+  }
+
+  if (fraction == 0) {
+    state->currentSpeed = 0;
+    writeInfoLog(fdlog_info, "Motor: obstacle ahead, stopped");
   }
 
-  return speed;
+  return state->currentSpeed * fraction;
+}
+
+// Moves the deadline forward by usec microseconds
+void addMicroseconds(struct timespec *deadline, long usec) {
+  deadline->tv_nsec += usec * 1000;
+  deadline->tv_sec += deadline->tv_nsec / 1000000000;
+  deadline->tv_nsec %= 1000000000;
 }
 
 void writeCoordinates(int fd, float coordinates) {
@@ -97,19 +176,119 @@ void writeCoordinates(int fd, float coordinates) {
   }
 }
 
+// Opens the motor's io_uring if MOMO_IO_URING is set (see uring.h)
+// Returns false if the motor uses plain system calls
+bool openTickUring(struct uring *ring) {
+  int ops[] = {IORING_OP_WRITE, URING_OP_FUTEX_WAIT, IORING_OP_LINK_TIMEOUT};
+
+  if (getenv("MOMO_IO_URING") == NULL) {
+    return false;
+  }
+  if (!openUring(ring, 8, ops, 3)) {
+    writeErrorLog(fdlog_err, "Motor: io_uring unavailable, using plain system "
+        "calls");
+    return false;
+  }
+  writeInfoLog(fdlog_info, "Motor: using io_uring");
+
+  return true;
+}
+
+// io_uring version of writeCoordinates() then waitCmdRing(): the coordinate
+// write (if isWriting) and the futex wait, linked to a timeout at the
+// absolute deadline, go to the kernel in a single system call
+// Returns true if woken up before the deadline
+bool waitTickUring(struct uring *ring, int fd, float *coordinates,
+    bool isWriting, struct cmdChannel *commands, uint32_t wakeup,
+    struct timespec *deadline) {
+  // (CLOCK_MONOTONIC, like the deadline)
+  struct __kernel_timespec timeout = {deadline->tv_sec, deadline->tv_nsec};
+  struct io_uring_sqe *sqe;
+  struct io_uring_cqe cqe;
+  int pending = 2;
+  bool isWoken = true;
+
+  if (isWriting) {
+    sqe = getSqe(ring);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t) coordinates;
+    sqe->len = sizeof(float);
+    sqe->off = -1; // (a pipe: no offset)
+    sqe->user_data = TICK_WRITE;
+    pending++;
+  }
+
+  sqe = getSqe(ring);
+  sqe->opcode = URING_OP_FUTEX_WAIT;
+  sqe->fd = URING_FUTEX2_SIZE_U32; // (shared: the ring is in another process)
+  sqe->addr = (uintptr_t) &commands->ring->wakeup;
+  sqe->addr2 = wakeup;
+  sqe->addr3 = FUTEX_BITSET_MATCH_ANY;
+  sqe->flags = IOSQE_IO_LINK;
+  sqe->user_data = TICK_WAIT;
+
+  sqe = getSqe(ring);
+  sqe->opcode = IORING_OP_LINK_TIMEOUT;
+  sqe->addr = (uintptr_t) &timeout;
+  sqe->len = 1;
+  sqe->timeout_flags = IORING_TIMEOUT_ABS;
+  sqe->user_data = TICK_TIMEOUT;
+
+  // every completion is reaped before returning: the kernel still uses the
+  // coordinate and the timeout until then (signals only restart the wait)
+  while (pending > 0) {
+    enterUring(ring, pending, 0);
+    while (reapCqe(ring, &cqe)) {
+      pending--;
+      if (cqe.user_data == TICK_WRITE && cqe.res < 0) {
+        errno = -cqe.res;
+        printf("Error %d in ", errno);
+        fflush(stdout);
+        perror("motor.h coordinate write");
+        writeErrorLog(fdlog_err, "Motor: waitTickUring write failed");
+        exit(-1);
+      } else if (cqe.user_data == TICK_WAIT) {
+        // woken up (0), or the word had already changed (-EAGAIN); canceled
+        // by the timeout at the deadline
+        isWoken = cqe.res != -ECANCELED;
+        if (cqe.res < 0 && cqe.res != -EAGAIN && cqe.res != -ECANCELED &&
+            cqe.res != -EINTR) {
+          errno = -cqe.res;
+          printf("Error %d in ", errno);
+          fflush(stdout);
+          perror("motor.h futex wait");
+          writeErrorLog(fdlog_err, "Motor: waitTickUring futex wait failed");
+          exit(-1);
+        }
+      }
+    }
+  }
+
+  return isWoken;
+}
+
 // Main loop that updates position and reads new commands from commander
 void motorLoop (char* axis) {
-  int fd[2]; // fd[0] commanderPipe, fd[1] inspectorPipe
-  int maxAxis;
-  bool isStopped = false;
-  char *commanderPipeName;
+  struct cmdChannel commands;
+  struct motorCheckpoint *checkpoint;
+  struct motorCheckpoint *otherCheckpoint;
+  struct obstacleField obstacles;
+  struct telemetryRing *telemetry;
+  int telemetryAxis;
+  int fdInspector;
   char *inspectorPipeName;
   char *pidPipeName;
-  float position = 0; // start from leftmost position on track
-  float simulationSpeed = SIM_SPEED;
+  char *otherAxis;
+  // start from leftmost position on track
+  struct motorState state = {0, 0, 0, false};
+  long simulationSpeed = getSimSpeed();
   float estimatedPosition;
-  float newSpeedStep = 0;
-  float currentSpeed = 0;
+  struct timespec deadline;
+  bool isTickDue = true;
+  struct uring ring;
+  bool isUring;
+  bool isWritePending = false;
 
   fdlog_info = openInfoLog();
   fdlog_err = openErrorLog();
@@ -120,13 +299,21 @@ void motorLoop (char* axis) {
 
   // selecting correct motor properties
   if (axis == "x") {
-    maxAxis = MAX_X;
-    commanderPipeName = "tmp/motorcommands_x";
+    openStats(STATS_MOTORX);
+    openTrace("motorx");
+    applyRtProfile("motorx");
+    telemetryAxis = 0;
+    otherAxis = "z";
+    state.maxAxis = MAX_X;
     inspectorPipeName = "tmp/motorinspector_x";
     pidPipeName = "tmp/PID_motorx";
   } else if (axis == "z") {
-    maxAxis = MAX_Z;
-    commanderPipeName = "tmp/motorcommands_z";
+    openStats(STATS_MOTORZ);
+    openTrace("motorz");
+    applyRtProfile("motorz");
+    telemetryAxis = 1;
+    otherAxis = "x";
+    state.maxAxis = MAX_Z;
     inspectorPipeName = "tmp/motorinspector_z";
     pidPipeName = "tmp/PID_motorz";
   } else {
@@ -140,66 +327,103 @@ void motorLoop (char* axis) {
   writePID(pidPipeName, true);
   writeInfoLog(fdlog_info, "Motor: sent PID to inspector");
 
-  activateMotor(fd, commanderPipeName, inspectorPipeName);
+  activateMotor(&commands, &fdInspector, axis, inspectorPipeName);
+
+  checkpoint = openCheckpoint(axis);
+  otherCheckpoint = openCheckpoint(otherAxis);
+  loadObstacles(&obstacles);
+  telemetry = mapTelemetry();
+  resumeMotor(&state, checkpoint, &commands);
+  isUring = openTickUring(&ring);
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
 
   while (1) {
-    newSpeedStep = readSpeed(fd[0]);
+    // sample the wakeup word before draining, so no urgent command is missed
+    uint32_t wakeup = cmdRingWakeup(&commands);
+    uint64_t tickStart = nowNs();
+    uint64_t traceTick = traceBegin();
+    uint64_t traceStage = traceBegin();
 
-    if (round(newSpeedStep) == 502) {
-      // SHUTDOWN command
-      writeInfoLog(fdlog_info, "Motor: SHUTDOWN command received");
+    if (applyCommands(&state, &commands)) {
       closeLog(fdlog_info);
       closeLog(fdlog_err);
-      closePipe(fd[0]);
-      closePipe(fd[1]);
+      closeCmdRing(&commands);
+      closePipe(fdInspector);
       exit(0);
-    } else if (round(newSpeedStep) == 500) {
-      // RESET command
-      writeInfoLog(fdlog_info, "Motor: RESET command received");
-      currentSpeed = 0;
-      position = -maxAxis; // FIXME: too sudden of a change
-    } else if (isStopped) {
-      // EMERGENCY STOP command has been signalled
-    } else if (round(newSpeedStep) == 501) {
-      // NON-EMERGENCY STOP
-      currentSpeed = 0;
-      writeInfoLog(fdlog_info, "Motor: stop request received");
-    } else {
-      // normal motor movement
-      if (newSpeedStep == 0) {
-        // pipe EOF - ignore this value
-      } else {
-        currentSpeed += newSpeedStep;
-        writeInfoLog(fdlog_info, "Motor: velocity command received");
+    }
+    commitCheckpoint(checkpoint, state.position, state.currentSpeed, &commands);
+    // (only now: a motor killed before the commit reads them again)
+    releaseCommands(&commands);
+    traceEnd("command read", traceStage);
+
+    if (isTickDue) {
+      traceStage = traceBegin();
+      if (!state.isStopped) {
+        state.position += obstacleStep(&state, &obstacles, otherCheckpoint,
+            telemetryAxis == 0);
       }
 
-      position += currentSpeed;
-    }
+      if (fabs(state.position) > state.maxAxis || state.position < 0) {
+        // reached end of track
+        writeInfoLog(fdlog_info, "Motor: reached end of track!");
+        countStat(&stats->endOfTrack, 1);
+        // minor correction to make sure position is always within bounds
+        if (state.position > 0) {
+          state.position = state.maxAxis;
+        } else {
+          state.position = 0;
+        }
+      }
 
-    if (fabs(position) > maxAxis || position < 0) {
-      // reached end of track
-      writeInfoLog(fdlog_info, "Motor: reached end of track!");
-      // minor correction to make sure position is always within bounds
-      if (position > 0) {
-        position = maxAxis;
-      } else {
-        position = 0;
+      // send current coordinate estimate to the inspector (with error)
+      float error = ((float)rand()/(float)(RAND_MAX)) - 0.5f;
+      estimatedPosition = state.position + error;
+
+      if (estimatedPosition < 0) {
+        estimatedPosition = 0.0f;
+      } else if (estimatedPosition > 100) {
+        estimatedPosition = 100.0f;
       }
-    }
+      commitCheckpoint(checkpoint, state.position, state.currentSpeed,
+          &commands);
+      traceEnd("physics step", traceStage);
 
-    // send current coordinate estimate to the inspector (with error)
-    float error = ((float)rand()/(float)(RAND_MAX)) - 0.5f;
-    estimatedPosition = position + error;
+      traceStage = traceBegin();
+      if (isUring) {
+        // (written along with the wait for the next tick)
+        isWritePending = true;
+      } else {
+        writeCoordinates(fdInspector, estimatedPosition);
+      }
+      publishTelemetry(telemetry, telemetryAxis, estimatedPosition,
+          state.isStopped ? 0 : state.currentSpeed);
+      traceEnd("publish", traceStage);
+      countStat(&stats->ticks, 1);
+      recordLatency(&stats->tickDuration, nowNs() - tickStart);
+      traceEnd("tick", traceTick);
 
-    if (estimatedPosition < 0) {
-      estimatedPosition = 0.0f;
-    } else if (estimatedPosition > 100) {
-      estimatedPosition = 100.0f;
+      // next tick deadline, to simulate a real motion (restart the schedule
+      // if we fell more than a whole tick behind)
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      addMicroseconds(&deadline, simulationSpeed);
+      if (deadline.tv_sec < now.tv_sec ||
+          (deadline.tv_sec == now.tv_sec && deadline.tv_nsec < now.tv_nsec)) {
+        deadline = now;
+        addMicroseconds(&deadline, simulationSpeed);
+      }
     }
 
-    writeCoordinates(fd[1], estimatedPosition);
-
-    // sleep for a preset amount of time, to simulate a real motion.
-    usleep(simulationSpeed);
+    // sleep until the tick deadline, unless an urgent command lands first
+    if (isUring) {
+      isTickDue = !waitTickUring(&ring, fdInspector, &estimatedPosition,
+          isWritePending, &commands, wakeup, &deadline);
+      isWritePending = false;
+    } else {
+      isTickDue = !waitCmdRing(&commands, wakeup, &deadline);
+    }
   }
 }
+
+#endif
@@ -0,0 +1,326 @@
+#ifndef MOMO_OBSTACLES_H
+#define MOMO_OBSTACLES_H
+
+#include "common.h"
+
+/*
+  Obstacles in the X/Z workspace, read at startup from the file named by the
+  MOMO_OBSTACLES environment variable (track units, z growing downwards like
+  the hook):
+
+    # shape  parameters
+    rect     40 60 55 100   # x1 z1 x2 z2
+    circle   80 30 6        # x z radius
+    resolution 0.25         # grid spacing (default 0.5, under 0.707)
+
+  The map is compiled once into a distance field: a grid over [0;MAX_X] x
+  [0;MAX_Z] holding, for every point, the distance to the nearest obstacle
+  (exact Euclidean distance transform of the rasterized map, in linear time).
+  The motors then check their clearance with a grid lookup per tick, however
+  many obstacles there are. Near an obstacle the hook slows down (within
+  OBSTACLE_SLOW) and stops at OBSTACLE_STOP; moving away is never limited.
+*/
+
+#define OBSTACLES_MAX 256
+#define OBSTACLE_LINE_SIZE 256
+// default grid spacing
+#define OBSTACLE_CELL 0.5f
+// clearance at which the hook stops
+#define OBSTACLE_STOP 1.0f
+// coarsest grid spacing: the field is off by up to a cell diagonal, which
+// must stay within the stop clearance
+#define OBSTACLE_MAX_CELL (OBSTACLE_STOP / (float) M_SQRT2)
+// clearance under which the hook slows down
+#define OBSTACLE_SLOW 10.0f
+// slowest speed near an obstacle, as a fraction of the commanded one
+#define OBSTACLE_MIN_SPEED 0.1f
+// distance of the grid points with no obstacle anywhere (squared, in cells)
+#define OBSTACLE_FAR 1e20f
+
+struct obstacle {
+  bool isCircle;
+  float x1, z1, x2, z2; // circle: center x1 z1, radius x2
+};
+
+struct obstacleMap {
+  struct obstacle obstacles[OBSTACLES_MAX];
+  int count;
+  float cell;
+};
+
+struct obstacleField {
+  float *clearance; // row-major, one row per grid z; NULL without obstacles
+  int columns;
+  int rows;
+  float cell;
+};
+
+void obstacleError(char *message) {
+  printf("%s\n", message);
+  fflush(stdout);
+  writeErrorLog(fdlog_err, message);
+  exit(-1);
+}
+
+void readObstacleMap(char *path, struct obstacleMap *map) {
+  char line[OBSTACLE_LINE_SIZE];
+  char message[OBSTACLE_LINE_SIZE + 64];
+  FILE *file = fopen(path, "r");
+  int number = 0;
+
+  if (file == NULL) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("obstacles.h fopen");
+    writeErrorLog(fdlog_err, "obstacles.h: readObstacleMap fopen failed");
+    exit(-1);
+  }
+
+  memset(map, 0, sizeof(struct obstacleMap));
+  map->cell = OBSTACLE_CELL;
+
+  while (fgets(line, sizeof(line), file) != NULL) {
+    struct obstacle *obstacle = &map->obstacles[map->count];
+    char shape[16];
+    char extra[2];
+    bool isValid;
+    number++;
+
+    if (line[strspn(line, " \t\n")] == '#' ||
+        line[strspn(line, " \t\n")] == 0) {
+      continue;
+    }
+    // (cut trailing comments)
+    line[strcspn(line, "#")] = 0;
+
+    if (sscanf(line, "%15s", shape) != 1) {
+      continue;
+    } else if (strcmp(shape, "rect") == 0) {
+      isValid = sscanf(line, "%*s %f %f %f %f %1s", &obstacle->x1,
+          &obstacle->z1, &obstacle->x2, &obstacle->z2, extra) == 4 &&
+          obstacle->x1 <= obstacle->x2 && obstacle->z1 <= obstacle->z2;
+    } else if (strcmp(shape, "circle") == 0) {
+      obstacle->isCircle = true;
+      isValid = sscanf(line, "%*s %f %f %f %1s", &obstacle->x1,
+          &obstacle->z1, &obstacle->x2, extra) == 3 && obstacle->x2 > 0;
+    } else if (strcmp(shape, "resolution") == 0) {
+      isValid = sscanf(line, "%*s %f %1s", &map->cell, extra) == 1 &&
+          map->cell >= 0.01f && map->cell < OBSTACLE_MAX_CELL;
+      if (isValid) {
+        continue;
+      }
+      snprintf(message, sizeof(message), "obstacles.h: bad resolution in "
+          "%s, line %d (at least 0.01, under %.3f)", path, number,
+          OBSTACLE_MAX_CELL);
+      obstacleError(message);
+    } else {
+      isValid = false;
+    }
+
+    if (!isValid || map->count == OBSTACLES_MAX) {
+      snprintf(message, sizeof(message), "obstacles.h: %s in %s, line %d",
+          isValid ? "too many obstacles" : "bad obstacle", path, number);
+      obstacleError(message);
+    }
+    map->count++;
+  }
+  fclose(file);
+}
+
+// Distance from a point to the obstacle (0 inside it)
+float shapeDistance(struct obstacle *obstacle, float x, float z) {
+  if (obstacle->isCircle) {
+    return fmaxf(hypotf(x - obstacle->x1, z - obstacle->z1) - obstacle->x2, 0);
+  }
+
+  float dx = fmaxf(fmaxf(obstacle->x1 - x, x - obstacle->x2), 0);
+  float dz = fmaxf(fmaxf(obstacle->z1 - z, z - obstacle->z2), 0);
+  return hypotf(dx, dz);
+}
+
+// Exact distance from a point to the nearest obstacle, by testing every
+// obstacle
+float obstacleDistance(struct obstacleMap *map, float x, float z) {
+  float nearest = INFINITY;
+
+  for (int i = 0; i < map->count; i++) {
+    nearest = fminf(nearest, shapeDistance(&map->obstacles[i], x, z));
+  }
+
+  return nearest;
+}
+
+// Squared distance transform, in place, of the n values f[0], f[stride], ...
+// as the lower envelope of the parabolas rooted at each of them (Felzenszwalb
+// and Huttenlocher). v and copy hold n entries, bounds n + 1
+void transformLine(float *f, int n, int stride, int *v, double *bounds,
+    float *copy) {
+  int k = 0;
+
+  for (int q = 0; q < n; q++) {
+    copy[q] = f[q * stride];
+  }
+
+  v[0] = 0;
+  bounds[0] = -INFINITY;
+  bounds[1] = INFINITY;
+  for (int q = 1; q < n; q++) {
+    // where the parabola of q gets below the last one of the envelope
+    double s = ((copy[q] + (double) q * q) -
+        (copy[v[k]] + (double) v[k] * v[k])) / (2.0 * (q - v[k]));
+    while (s <= bounds[k]) {
+      k--;
+      s = ((copy[q] + (double) q * q) -
+          (copy[v[k]] + (double) v[k] * v[k])) / (2.0 * (q - v[k]));
+    }
+    k++;
+    v[k] = q;
+    bounds[k] = s;
+    bounds[k + 1] = INFINITY;
+  }
+
+  k = 0;
+  for (int q = 0; q < n; q++) {
+    while (bounds[k + 1] < q) {
+      k++;
+    }
+    f[q * stride] = (float) (q - v[k]) * (q - v[k]) + copy[v[k]];
+  }
+}
+
+// Rasterizes the map and computes its distance field
+void compileObstacleField(struct obstacleMap *map,
+    struct obstacleField *field) {
+  int longest;
+
+  field->cell = map->cell;
+  field->columns = (int) (MAX_X / map->cell) + 1;
+  field->rows = (int) (MAX_Z / map->cell) + 1;
+  field->clearance = malloc((size_t) field->columns * field->rows *
+      sizeof(float));
+  longest = field->columns > field->rows ? field->columns : field->rows;
+  int *v = malloc(longest * sizeof(int));
+  double *bounds = malloc((longest + 1) * sizeof(double));
+  float *copy = malloc(longest * sizeof(float));
+  if (field->clearance == NULL || v == NULL || bounds == NULL ||
+      copy == NULL) {
+    obstacleError("obstacles.h: not enough memory for the distance field");
+  }
+
+  for (long i = 0; i < (long) field->columns * field->rows; i++) {
+    field->clearance[i] = OBSTACLE_FAR;
+  }
+  // a grid point is an obstacle if one comes within half a cell diagonal of
+  // it, so that none falls between the grid points (each obstacle only over
+  // the grid points of its bounding box)
+  float margin = map->cell * (float) M_SQRT1_2;
+  for (int i = 0; i < map->count; i++) {
+    struct obstacle *obstacle = &map->obstacles[i];
+    float radius = obstacle->isCircle ? obstacle->x2 : 0;
+    float left = obstacle->x1 - radius - margin;
+    float right = (obstacle->isCircle ? obstacle->x1 + radius : obstacle->x2) +
+        margin;
+    float top = obstacle->z1 - radius - margin;
+    float bottom = (obstacle->isCircle ? obstacle->z1 + radius : obstacle->z2) +
+        margin;
+    int firstColumn = fmaxf(ceilf(left / map->cell), 0);
+    int lastColumn = fminf(floorf(right / map->cell), field->columns - 1);
+    int firstRow = fmaxf(ceilf(top / map->cell), 0);
+    int lastRow = fminf(floorf(bottom / map->cell), field->rows - 1);
+
+    for (int row = firstRow; row <= lastRow; row++) {
+      for (int column = firstColumn; column <= lastColumn; column++) {
+        if (shapeDistance(obstacle, column * map->cell, row * map->cell) <=
+            margin) {
+          field->clearance[row * field->columns + column] = 0;
+        }
+      }
+    }
+  }
+
+  // separable: along z for every column, then along x for every row
+  for (int column = 0; column < field->columns; column++) {
+    transformLine(&field->clearance[column], field->rows, field->columns, v,
+        bounds, copy);
+  }
+  for (int row = 0; row < field->rows; row++) {
+    transformLine(&field->clearance[row * field->columns], field->columns, 1,
+        v, bounds, copy);
+  }
+  for (long i = 0; i < (long) field->columns * field->rows; i++) {
+    field->clearance[i] = sqrtf(field->clearance[i]) * map->cell;
+  }
+
+  free(v);
+  free(bounds);
+  free(copy);
+}
+
+// Reads and compiles the map named by MOMO_OBSTACLES
+// Returns false (leaving the field empty) if there is none
+bool loadObstacles(struct obstacleField *field) {
+  char *path = getenv("MOMO_OBSTACLES");
+  struct obstacleMap *map;
+  char summary[128];
+
+  memset(field, 0, sizeof(struct obstacleField));
+  if (path == NULL) {
+    return false;
+  }
+
+  // (large: OBSTACLES_MAX obstacles)
+  map = malloc(sizeof(struct obstacleMap));
+  readObstacleMap(path, map);
+  compileObstacleField(map, field);
+  snprintf(summary, sizeof(summary), "Obstacles: %d obstacles compiled into "
+      "a %dx%d distance field", map->count, field->columns, field->rows);
+  writeInfoLog(fdlog_info, summary);
+  free(map);
+
+  return true;
+}
+
+// Distance from the point to the nearest obstacle, read at the nearest grid
+// point (off by at most a cell diagonal: half for the rasterized obstacles,
+// half for the lookup)
+float obstacleClearance(struct obstacleField *field, float x, float z) {
+  int column = x / field->cell + 0.5f;
+  int row = z / field->cell + 0.5f;
+
+  column = column < 0 ? 0 : column >= field->columns ? field->columns - 1 :
+      column;
+  row = row < 0 ? 0 : row >= field->rows ? field->rows - 1 : row;
+
+  return field->clearance[row * field->columns + column];
+}
+
+// Fraction (0 to 1) of the step (dx, dz) from (x, z) the hook may make
+float obstacleStepFraction(struct obstacleField *field, float x, float z,
+    float dx, float dz) {
+  float length = hypotf(dx, dz);
+  float here;
+  float ahead;
+
+  if (field->clearance == NULL || length == 0) {
+    return 1;
+  }
+
+  here = obstacleClearance(field, x, z);
+  ahead = obstacleClearance(field, x + dx, z + dz);
+  // moving away (or already inside an obstacle, where it can only get out),
+  // on a segment covered by the free discs around its two ends
+  if ((ahead >= here && length <= here + ahead) || here == 0) {
+    return 1;
+  }
+
+  // approaching: slower and slower, and never further than the free disc
+  // around the start (so not through a thin obstacle either)
+  float speed = (here - OBSTACLE_STOP) / (OBSTACLE_SLOW - OBSTACLE_STOP);
+  speed = speed > 1 ? 1 : speed < OBSTACLE_MIN_SPEED ? OBSTACLE_MIN_SPEED :
+      speed;
+  float allowed = fminf(length * speed, here - OBSTACLE_STOP);
+
+  return allowed > 0 ? allowed / length : 0;
+}
+
+#endif
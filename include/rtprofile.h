@@ -0,0 +1,261 @@
+#ifndef MOMO_RTPROFILE_H
+#define MOMO_RTPROFILE_H
+
+#include <alloca.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "common.h"
+
+/*
+  Opt-in real-time profile, read at startup from the file named by the
+  MOMO_RT_PROFILE environment variable. Each line configures one role
+  (motorx, motorz, watchdog, ...); a role without a line keeps the default
+  scheduling:
+
+    # role   settings
+    motorx   cpus=1 policy=fifo priority=80 mlock=yes
+    motorz   cpus=2 policy=fifo priority=80 mlock=yes
+    watchdog cpus=0 policy=rr priority=10
+
+  cpus      cores the process may run on (e.g. 1 or 0,2-3)
+  policy    fifo (SCHED_FIFO), rr (SCHED_RR) or other (default scheduler)
+  priority  real-time priority, 1 to 99
+  mlock     yes: lock all present and future memory (mlockall) and prefault
+            stack KB of stack (default 256, and below the stack limit), so
+            ticks never page fault
+  Settings that cannot be applied (e.g. without CAP_SYS_NICE) are reported
+  and skipped: the process still runs, with the default scheduling.
+*/
+
+#define RT_MAX_CPUS 1024
+#define RT_STACK_KB 256
+// stack left out of the prefault: arguments, environment and the callers
+#define RT_STACK_RESERVE_KB 256
+#define RT_LINE_SIZE 256
+
+struct rtProfile {
+  bool hasCpus;
+  unsigned long cpus[RT_MAX_CPUS / (8 * sizeof(unsigned long))];
+  int policy;
+  int priority;
+  bool isLocking;
+  long stackKb;
+};
+
+void rtProfileError(char *message) {
+  printf("%s\n", message);
+  fflush(stdout);
+  writeErrorLog(fdlog_err, message);
+  exit(-1);
+}
+
+// Most stack a profile may prefault, in KB: the stack limit less what the
+// process already uses
+long maxStackKb() {
+  struct rlimit limit;
+
+  if (getrlimit(RLIMIT_STACK, &limit) == -1 ||
+      limit.rlim_cur == RLIM_INFINITY) {
+    return LONG_MAX;
+  }
+
+  return (long) (limit.rlim_cur / 1024) - RT_STACK_RESERVE_KB;
+}
+
+// Parses a CPU list such as "0,2-3" into the profile's mask
+bool parseCpus(char *list, struct rtProfile *profile) {
+  char *next = list;
+
+  memset(profile->cpus, 0, sizeof(profile->cpus));
+  while (*next != 0) {
+    char *end;
+    long first = strtol(next, &end, 10);
+    long last = first;
+
+    if (end == next) {
+      return false;
+    }
+    if (*end == '-') {
+      next = end + 1;
+      last = strtol(next, &end, 10);
+      if (end == next) {
+        return false;
+      }
+    }
+    if (first < 0 || last < first || last >= RT_MAX_CPUS) {
+      return false;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      profile->cpus[cpu / (8 * sizeof(unsigned long))] |=
+          1ul << (cpu % (8 * sizeof(unsigned long)));
+    }
+    if (*end == ',') {
+      end++;
+    } else if (*end != 0) {
+      return false;
+    }
+    next = end;
+  }
+
+  profile->hasCpus = true;
+  return true;
+}
+
+// Reads the settings of the role from the profile file
+// Returns false if the file has no line for the role
+bool readRtProfile(char *path, char *role, struct rtProfile *profile) {
+  char line[RT_LINE_SIZE];
+  char message[RT_LINE_SIZE + 64];
+  bool isFound = false;
+  FILE *file = fopen(path, "r");
+
+  if (file == NULL) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("rtprofile.h fopen");
+    writeErrorLog(fdlog_err, "rtprofile.h: readRtProfile fopen failed");
+    exit(-1);
+  }
+
+  memset(profile, 0, sizeof(struct rtProfile));
+  profile->policy = SCHED_OTHER;
+  profile->stackKb = RT_STACK_KB;
+
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char *save;
+    char *word = strtok_r(line, " \t\n", &save);
+
+    if (word == NULL || word[0] == '#' || strcmp(word, role) != 0) {
+      continue;
+    }
+    isFound = true;
+
+    while ((word = strtok_r(NULL, " \t\n", &save)) != NULL) {
+      char *value = strchr(word, '=');
+      bool isValid = value != NULL;
+
+      if (isValid) {
+        *value++ = 0;
+        if (strcmp(word, "cpus") == 0) {
+          isValid = parseCpus(value, profile);
+        } else if (strcmp(word, "policy") == 0) {
+          if (strcmp(value, "fifo") == 0) {
+            profile->policy = SCHED_FIFO;
+          } else if (strcmp(value, "rr") == 0) {
+            profile->policy = SCHED_RR;
+          } else {
+            isValid = strcmp(value, "other") == 0;
+          }
+        } else if (strcmp(word, "priority") == 0) {
+          profile->priority = atoi(value);
+          isValid = profile->priority >= 1 && profile->priority <= 99;
+        } else if (strcmp(word, "mlock") == 0) {
+          profile->isLocking = strcmp(value, "yes") == 0;
+          isValid = profile->isLocking || strcmp(value, "no") == 0;
+        } else if (strcmp(word, "stack") == 0) {
+          profile->stackKb = atol(value);
+          isValid = profile->stackKb > 0;
+          if (isValid && profile->stackKb > maxStackKb()) {
+            snprintf(message, sizeof(message), "rtprofile.h: stack=%ld for "
+                "%s in %s is past the stack limit (at most %ld KB)",
+                profile->stackKb, role, path, maxStackKb());
+            rtProfileError(message);
+          }
+        } else {
+          isValid = false;
+        }
+      }
+
+      if (!isValid) {
+        snprintf(message, sizeof(message), "rtprofile.h: bad setting \"%s\" "
+            "for %s in %s", word, role, path);
+        rtProfileError(message);
+      }
+    }
+  }
+  fclose(file);
+
+  if (isFound && profile->policy != SCHED_OTHER && profile->priority == 0) {
+    snprintf(message, sizeof(message), "rtprofile.h: %s needs a priority for "
+        "its real-time policy in %s", role, path);
+    rtProfileError(message);
+  }
+
+  return isFound;
+}
+
+// Touches the given amount of stack below the caller, so that the pages
+// are present (and locked) before the first tick needs them
+__attribute__((noinline)) void prefaultStack(long bytes) {
+  char *stack = alloca(bytes);
+
+  for (long i = 0; i < bytes; i += 4096) {
+    stack[i] = 0;
+  }
+  // (the stores are otherwise dead, and would be dropped)
+  __asm__ volatile("" : : "r"(stack) : "memory");
+}
+
+// Restricts the calling process to the cores of the profile, if it has some
+void setRtAffinity(struct rtProfile *profile) {
+  // (raw syscall: cpu_set_t needs _GNU_SOURCE)
+  if (profile->hasCpus && syscall(SYS_sched_setaffinity, 0,
+      sizeof(profile->cpus), profile->cpus) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("rtprofile.h sched_setaffinity");
+    writeErrorLog(fdlog_err,
+        "rtprofile.h: setRtAffinity sched_setaffinity failed");
+  }
+}
+
+// Applies the profile of the role, if MOMO_RT_PROFILE names a profile
+// Returns true if the role had settings
+bool applyRtProfile(char *role) {
+  char *path = getenv("MOMO_RT_PROFILE");
+  struct rtProfile profile;
+  char summary[128];
+
+  if (path == NULL || !readRtProfile(path, role, &profile)) {
+    return false;
+  }
+
+  // lock first, so that the prefaulted stack stays resident
+  if (profile.isLocking) {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+      printf("Error %d in ", errno);
+      fflush(stdout);
+      perror("rtprofile.h mlockall");
+      writeErrorLog(fdlog_err, "rtprofile.h: applyRtProfile mlockall failed");
+    } else {
+      prefaultStack(profile.stackKb * 1024);
+    }
+  }
+
+  setRtAffinity(&profile);
+
+  if (profile.policy != SCHED_OTHER) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = profile.priority;
+    if (sched_setscheduler(0, profile.policy, &param) == -1) {
+      printf("Error %d in ", errno);
+      fflush(stdout);
+      perror("rtprofile.h sched_setscheduler");
+      writeErrorLog(fdlog_err,
+          "rtprofile.h: applyRtProfile sched_setscheduler failed");
+    }
+  }
+
+  snprintf(summary, sizeof(summary), "RT profile: %s running with policy %d, "
+      "priority %d, memory %s", role, sched_getscheduler(0),
+      profile.priority, profile.isLocking ? "locked" : "unlocked");
+  writeInfoLog(fdlog_info, summary);
+
+  return true;
+}
+
+#endif
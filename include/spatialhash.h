@@ -0,0 +1,184 @@
+#ifndef MOMO_SPATIALHASH_H
+#define MOMO_SPATIALHASH_H
+
+#include "common.h"
+
+/*
+  Spatial hash of hook positions in the X/Z plane, to find the hooks closer
+  than a given distance without testing every pair. The plane is cut into
+  square cells at least that distance wide, and every hook is linked into the
+  bucket its cell hashes to: near hooks are then in the same cell or in one
+  of the 8 around it, so a query visits 5 cells per hook (its own and half of
+  the neighbours, each pair of cells being visited from one side). Moving a
+  hook only relinks it when it changes cells, so keeping the hash up to date
+  costs O(1) per hook and tick, and a query O(hooks + pairs found) for a
+  bounded density.
+  The yard is unbounded (cells are hashed, not indexed) and all memory is
+  allocated once, for a maximum number of hooks.
+*/
+
+struct spatialHash {
+  float cellSize;
+  int bucketMask; // buckets - 1 (a power of two)
+  int *heads; // first hook of each bucket, -1 if none
+  // per hook
+  int *next; // in its bucket, -1 at the end
+  int *previous;
+  int *cellX;
+  int *cellZ;
+  float *x;
+  float *z;
+  int count;
+  int capacity;
+};
+
+struct hookPair {
+  int first; // first < second
+  int second;
+  float distance;
+};
+
+void initSpatialHash(struct spatialHash *hash, int capacity, float cellSize) {
+  int buckets = 1;
+
+  // about half of the buckets empty: short chains, few shared buckets
+  while (buckets < 2 * capacity) {
+    buckets *= 2;
+  }
+
+  hash->cellSize = cellSize;
+  hash->bucketMask = buckets - 1;
+  hash->count = 0;
+  hash->capacity = capacity;
+  hash->heads = malloc(buckets * sizeof(int));
+  hash->next = malloc(capacity * sizeof(int));
+  hash->previous = malloc(capacity * sizeof(int));
+  hash->cellX = malloc(capacity * sizeof(int));
+  hash->cellZ = malloc(capacity * sizeof(int));
+  hash->x = malloc(capacity * sizeof(float));
+  hash->z = malloc(capacity * sizeof(float));
+  if (hash->heads == NULL || hash->next == NULL || hash->previous == NULL ||
+      hash->cellX == NULL || hash->cellZ == NULL || hash->x == NULL ||
+      hash->z == NULL) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("spatialhash.h malloc");
+    writeErrorLog(fdlog_err, "spatialhash.h: initSpatialHash malloc failed");
+    exit(-1);
+  }
+  memset(hash->heads, -1, buckets * sizeof(int));
+}
+
+void freeSpatialHash(struct spatialHash *hash) {
+  free(hash->heads);
+  free(hash->next);
+  free(hash->previous);
+  free(hash->cellX);
+  free(hash->cellZ);
+  free(hash->x);
+  free(hash->z);
+}
+
+int cellBucket(struct spatialHash *hash, int cellX, int cellZ) {
+  return ((unsigned) cellX * 73856093u ^ (unsigned) cellZ * 19349663u) &
+      hash->bucketMask;
+}
+
+void linkHook(struct spatialHash *hash, int hook) {
+  int bucket = cellBucket(hash, hash->cellX[hook], hash->cellZ[hook]);
+
+  hash->previous[hook] = -1;
+  hash->next[hook] = hash->heads[bucket];
+  if (hash->heads[bucket] != -1) {
+    hash->previous[hash->heads[bucket]] = hook;
+  }
+  hash->heads[bucket] = hook;
+}
+
+void unlinkHook(struct spatialHash *hash, int hook) {
+  if (hash->previous[hook] != -1) {
+    hash->next[hash->previous[hook]] = hash->next[hook];
+  } else {
+    hash->heads[cellBucket(hash, hash->cellX[hook], hash->cellZ[hook])] =
+        hash->next[hook];
+  }
+  if (hash->next[hook] != -1) {
+    hash->previous[hash->next[hook]] = hash->previous[hook];
+  }
+}
+
+// Adds a hook, numbered from 0 in the order they are added
+// Returns its number
+int addHook(struct spatialHash *hash, float x, float z) {
+  int hook = hash->count++;
+
+  if (hook == hash->capacity) {
+    writeErrorLog(fdlog_err, "spatialhash.h: addHook over capacity");
+    exit(-1);
+  }
+  hash->x[hook] = x;
+  hash->z[hook] = z;
+  hash->cellX[hook] = floorf(x / hash->cellSize);
+  hash->cellZ[hook] = floorf(z / hash->cellSize);
+  linkHook(hash, hook);
+
+  return hook;
+}
+
+// Updates the position of a hook, relinking it only if it changed cells
+void moveHook(struct spatialHash *hash, int hook, float x, float z) {
+  int cellX = floorf(x / hash->cellSize);
+  int cellZ = floorf(z / hash->cellSize);
+
+  hash->x[hook] = x;
+  hash->z[hook] = z;
+  if (cellX != hash->cellX[hook] || cellZ != hash->cellZ[hook]) {
+    unlinkHook(hash, hook);
+    hash->cellX[hook] = cellX;
+    hash->cellZ[hook] = cellZ;
+    linkHook(hash, hook);
+  }
+}
+
+// Finds every pair of hooks closer than distance (at most the cell size),
+// storing up to max of them in pairs
+// Returns the number of pairs found (even beyond max)
+long findNearHooks(struct spatialHash *hash, float distance,
+    struct hookPair pairs[], long max) {
+  // the hook's own cell, then the 4 neighbours "after" it: each pair of
+  // neighbouring cells is visited from one side only
+  int stencil[5][2] = {{0, 0}, {1, -1}, {1, 0}, {1, 1}, {0, 1}};
+  float limit = distance * distance;
+  long found = 0;
+
+  for (int hook = 0; hook < hash->count; hook++) {
+    for (int i = 0; i < 5; i++) {
+      int cellX = hash->cellX[hook] + stencil[i][0];
+      int cellZ = hash->cellZ[hook] + stencil[i][1];
+      int other = hash->heads[cellBucket(hash, cellX, cellZ)];
+
+      for (; other != -1; other = hash->next[other]) {
+        // (only hooks of this very cell: other cells may share its bucket,
+        // and in the hook's own cell, each pair once)
+        if (hash->cellX[other] != cellX || hash->cellZ[other] != cellZ ||
+            (i == 0 && other <= hook)) {
+          continue;
+        }
+        float dx = hash->x[other] - hash->x[hook];
+        float dz = hash->z[other] - hash->z[hook];
+        if (dx * dx + dz * dz < limit) {
+          if (found < max) {
+            pairs[found].first = hook < other ? hook : other;
+            pairs[found].second = hook < other ? other : hook;
+            pairs[found].distance = sqrtf(dx * dx + dz * dz);
+          }
+          found++;
+        }
+      }
+    }
+  }
+
+  return found;
+}
+
+#endif
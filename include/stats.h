@@ -0,0 +1,166 @@
+#ifndef MOMO_STATS_H
+#define MOMO_STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+/*
+  Shared-memory metrics page. Every process owns one slot of tmp/stats, where
+  it keeps counters and latency histograms up to date with plain atomic
+  increments (no syscall, no lock). momo-stat maps the same file and samples
+  it. Included by common.h, after the log prototypes.
+*/
+
+// one slot per process role
+#define STATS_WATCHDOG 0
+#define STATS_COMMANDER 1
+#define STATS_INSPECTOR 2
+#define STATS_MOTORX 3
+#define STATS_MOTORZ 4
+#define STATS_PROCESSES 5
+
+// latency histograms: 4 buckets per power of two of nanoseconds
+#define STATS_BUCKETS 256
+
+struct statsHistogram {
+  _Atomic uint64_t count;
+  _Atomic uint64_t sumNs;
+  _Atomic uint64_t buckets[STATS_BUCKETS];
+};
+
+struct processStats {
+  _Atomic int32_t pid;
+  _Atomic uint64_t ticks; // motor ticks, inspector frames, watchdog scans
+  _Atomic uint64_t commands; // commands sent (commander, inspector) or applied
+  _Atomic uint64_t queueDepth; // commands found in the ring at the last drain
+  _Atomic uint64_t maxQueueDepth;
+  _Atomic uint64_t endOfTrack;
+  _Atomic uint64_t heartbeats; // OK signals received by the watchdog
+  _Atomic uint64_t logWrites;
+  struct statsHistogram tickDuration;
+  struct statsHistogram logLatency;
+} __attribute__((aligned(64)));
+
+struct statsPage {
+  struct processStats processes[STATS_PROCESSES];
+};
+
+char *statsNames[STATS_PROCESSES] = {"watchdog", "commander", "inspector",
+    "motorx", "motorz"};
+
+// this process' slot, NULL until openStats() is called
+struct processStats *stats = NULL;
+
+// CLOCK_MONOTONIC timestamp in nanoseconds
+uint64_t nowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Maps tmp/stats (creating it if needed)
+struct statsPage *mapStats() {
+  struct statsPage *page;
+  struct stat info;
+  int fd;
+
+  fd = open("tmp/stats", O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (fd == -1 || fstat(fd, &info) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("stats.h open");
+    writeErrorLog(fdlog_err, "stats.h: mapStats open failed");
+    exit(-1);
+  }
+  // (growing an existing file keeps the counters of whoever is running)
+  if (info.st_size < sizeof(struct statsPage) &&
+      ftruncate(fd, sizeof(struct statsPage)) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("stats.h ftruncate");
+    writeErrorLog(fdlog_err, "stats.h: mapStats ftruncate failed");
+    exit(-1);
+  }
+
+  page = mmap(NULL, sizeof(struct statsPage), PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, 0);
+  if (page == MAP_FAILED) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("stats.h mmap");
+    writeErrorLog(fdlog_err, "stats.h: mapStats mmap failed");
+    exit(-1);
+  }
+  close(fd);
+
+  return page;
+}
+
+// Claims the slot of the given role (STATS_MOTORX, ...) for this process
+void openStats(int role) {
+  stats = &mapStats()->processes[role];
+  memset(stats, 0, sizeof(struct processStats));
+  atomic_store(&stats->pid, getpid());
+}
+
+void countStat(_Atomic uint64_t *counter, uint64_t amount) {
+  atomic_fetch_add_explicit(counter, amount, memory_order_relaxed);
+}
+
+void setStat(_Atomic uint64_t *gauge, uint64_t value) {
+  atomic_store_explicit(gauge, value, memory_order_relaxed);
+}
+
+int statsBucket(uint64_t ns) {
+  if (ns < 4) {
+    return ns;
+  }
+
+  int log = 63 - __builtin_clzll(ns);
+  int bucket = (log - 1) * 4 + ((ns >> (log - 2)) & 3);
+
+  return bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+}
+
+// smallest value (ns) that falls in the bucket
+uint64_t statsBucketFloor(int bucket) {
+  if (bucket < 4) {
+    return bucket;
+  }
+
+  return (uint64_t) (4 + bucket % 4) << (bucket / 4 - 1);
+}
+
+// p-th percentile (0 < p <= 100) of the samples recorded between two
+// snapshots of a histogram, in nanoseconds (middle of the matching bucket)
+uint64_t histogramPercentile(struct statsHistogram *now,
+    struct statsHistogram *before, double p) {
+  uint64_t count = now->count - before->count;
+  uint64_t seen = 0;
+
+  if (count == 0) {
+    return 0;
+  }
+
+  for (int i = 0; i < STATS_BUCKETS; i++) {
+    seen += now->buckets[i] - before->buckets[i];
+    if (seen >= ceil(p / 100.0 * count)) {
+      if (i == STATS_BUCKETS - 1) {
+        return statsBucketFloor(i);
+      }
+      return (statsBucketFloor(i) + statsBucketFloor(i + 1)) / 2;
+    }
+  }
+
+  return statsBucketFloor(STATS_BUCKETS - 1);
+}
+
+void recordLatency(struct statsHistogram *histogram, uint64_t ns) {
+  atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&histogram->sumNs, ns, memory_order_relaxed);
+  atomic_fetch_add_explicit(&histogram->buckets[statsBucket(ns)], 1,
+      memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef MOMO_TELEMETRY_H
+#define MOMO_TELEMETRY_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "common.h"
+#include "cmdring.h"
+
+/*
+  Shared-memory telemetry ring, mapped from tmp/telemetry. Every motor tick
+  writes a sample (time, position estimate as sent to the inspector,
+  velocity) into its axis' ring, overwriting the oldest one: the motors never
+  wait for a reader, whether momo-telemetry runs, lags or not. Readers keep
+  their own cursor and detect overwritten samples from the slot sequence
+  numbers. A futex word wakes the reader up, with a syscall only when it
+  actually sleeps.
+*/
+
+#define TELEMETRY_AXES 2
+// samples kept per axis (must be a power of two)
+#define TELEMETRY_SLOTS 1024
+
+struct telemetrySample {
+  uint64_t timeNs; // CLOCK_MONOTONIC
+  float position;
+  float velocity;
+  uint32_t axis; // 0: x, 1: z
+  uint32_t tick;
+};
+
+struct telemetrySlot {
+  _Atomic uint64_t sequence; // index of the sample + 1, 0 while written
+  struct telemetrySample sample;
+};
+
+struct telemetryAxis {
+  _Atomic uint64_t head; // samples written so far
+  char pad[56];
+  struct telemetrySlot slots[TELEMETRY_SLOTS];
+};
+
+struct telemetryRing {
+  _Atomic uint32_t wakeup; // futex word, bumped by every sample
+  _Atomic uint32_t readersWaiting;
+  char pad[56];
+  struct telemetryAxis axes[TELEMETRY_AXES];
+};
+
+// Maps tmp/telemetry (creating it if needed)
+struct telemetryRing *mapTelemetry() {
+  struct telemetryRing *ring;
+  struct stat info;
+  int fd;
+
+  fd = open("tmp/telemetry", O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (fd == -1 || fstat(fd, &info) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("telemetry.h open");
+    writeErrorLog(fdlog_err, "telemetry.h: mapTelemetry open failed");
+    exit(-1);
+  }
+  if (info.st_size < sizeof(struct telemetryRing) &&
+      ftruncate(fd, sizeof(struct telemetryRing)) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("telemetry.h ftruncate");
+    writeErrorLog(fdlog_err, "telemetry.h: mapTelemetry ftruncate failed");
+    exit(-1);
+  }
+
+  ring = mmap(NULL, sizeof(struct telemetryRing), PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, 0);
+  if (ring == MAP_FAILED) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("telemetry.h mmap");
+    writeErrorLog(fdlog_err, "telemetry.h: mapTelemetry mmap failed");
+    exit(-1);
+  }
+  close(fd);
+
+  return ring;
+}
+
+// Writes a sample into the axis' ring (one writer per axis)
+void publishTelemetry(struct telemetryRing *ring, int axis, float position,
+    float velocity) {
+  struct telemetryAxis *samples = &ring->axes[axis];
+  uint64_t head = atomic_load_explicit(&samples->head, memory_order_relaxed);
+  struct telemetrySlot *slot = &samples->slots[head % TELEMETRY_SLOTS];
+
+  // readers that see 0 (or an older sequence) skip the slot
+  atomic_store_explicit(&slot->sequence, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot->sample.timeNs = nowNs();
+  slot->sample.position = position;
+  slot->sample.velocity = velocity;
+  slot->sample.axis = axis;
+  slot->sample.tick = head;
+  atomic_store_explicit(&slot->sequence, head + 1, memory_order_release);
+  atomic_store_explicit(&samples->head, head + 1, memory_order_release);
+
+  // (sequentially consistent, like readersWaiting: either the reader sees
+  // the new wakeup value, or the writer sees the reader waiting)
+  atomic_fetch_add(&ring->wakeup, 1);
+  if (atomic_load(&ring->readersWaiting) > 0) {
+    futex(&ring->wakeup, FUTEX_WAKE, INT_MAX, NULL, 0);
+  }
+}
+
+// Reads the samples of the axis written since *cursor, up to max, and moves
+// the cursor past them. Samples overwritten before they could be read are
+// counted in *lost. Returns the number of samples read
+int readTelemetry(struct telemetryRing *ring, int axis, uint64_t *cursor,
+    struct telemetrySample samples[], int max, uint64_t *lost) {
+  struct telemetryAxis *axisRing = &ring->axes[axis];
+  uint64_t head = atomic_load_explicit(&axisRing->head, memory_order_acquire);
+  int count = 0;
+
+  if (head - *cursor > TELEMETRY_SLOTS) {
+    *lost += head - TELEMETRY_SLOTS - *cursor;
+    *cursor = head - TELEMETRY_SLOTS;
+  }
+
+  while (*cursor < head && count < max) {
+    struct telemetrySlot *slot = &axisRing->slots[*cursor % TELEMETRY_SLOTS];
+
+    samples[count] = slot->sample;
+    atomic_thread_fence(memory_order_acquire);
+    // (seqlock check: the writer may have lapped us during the copy)
+    if (atomic_load_explicit(&slot->sequence, memory_order_relaxed) ==
+        *cursor + 1) {
+      count++;
+    } else {
+      (*lost)++;
+    }
+    (*cursor)++;
+  }
+
+  return count;
+}
+
+// Sleeps until a sample is published after wakeup was sampled
+void waitTelemetry(struct telemetryRing *ring, uint32_t wakeup) {
+  atomic_fetch_add(&ring->readersWaiting, 1);
+  futex(&ring->wakeup, FUTEX_WAIT, wakeup, NULL, 0);
+  atomic_fetch_sub(&ring->readersWaiting, 1);
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef MOMO_TRACE_H
+#define MOMO_TRACE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+
+/*
+  Optional tracing of the tick pipeline, enabled by setting the MOMO_TRACE
+  environment variable. Every thread records complete events (stage name,
+  start, duration) into its own buffer, which is appended to logs/trace.json
+  in Chrome trace-event format when full, at least once a second and at exit.
+  All processes share the file and the CLOCK_MONOTONIC time base, so a whole
+  run opens as one timeline in chrome://tracing or ui.perfetto.dev (delete
+  the file to start a new trace). When disabled, each event costs one branch.
+  Included by common.h, after stats.h.
+*/
+
+#define TRACE_EVENTS 512
+// flush at least this often, so that SIGKILLed motors lose little
+#define TRACE_FLUSH_NS 1000000000ull
+
+struct traceEvent {
+  char *name; // string literal
+  uint64_t startNs;
+  uint64_t durationNs;
+};
+
+bool isTracing = false;
+int fdtrace = -1;
+__thread struct traceEvent traceEvents[TRACE_EVENTS];
+__thread int traceCount = 0;
+__thread uint64_t traceFlushedNs = 0;
+// set while traceEnd() records an event: a signal handler that traces in the
+// middle of it drops its own event rather than corrupting the buffer
+__thread volatile sig_atomic_t isTraceRecording = false;
+
+// Appends this thread's buffered events to the trace file
+void flushTrace() {
+  // (at most ~160 bytes per event)
+  static __thread char buffer[TRACE_EVENTS * 160];
+  int length = 0;
+  long tid = syscall(SYS_gettid);
+
+  for (int i = 0; i < traceCount; i++) {
+    length += sprintf(buffer + length, "{\"name\":\"%s\",\"ph\":\"X\","
+        "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%ld},\n",
+        traceEvents[i].name, traceEvents[i].startNs / 1e3,
+        traceEvents[i].durationNs / 1e3, getpid(), tid);
+  }
+  traceCount = 0;
+  traceFlushedNs = nowNs();
+
+  // one write() per flush: O_APPEND keeps the processes' chunks whole
+  if (length > 0 && write(fdtrace, buffer, length) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("trace.h write");
+    writeErrorLog(fdlog_err, "trace.h: flushTrace write failed");
+  }
+}
+
+// Starts tracing this process if MOMO_TRACE is set
+void openTrace(char *processName) {
+  char metadata[128];
+
+  if (getenv("MOMO_TRACE") == NULL) {
+    return;
+  }
+
+  // whoever creates the file opens the JSON array
+  // (not inherited by the programs we exec, e.g. restarted motors)
+  fdtrace = open("logs/trace.json",
+      O_WRONLY | O_APPEND | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+  if (fdtrace != -1) {
+    write(fdtrace, "[\n", 2);
+  } else if (errno == EEXIST) {
+    fdtrace = open("logs/trace.json", O_WRONLY | O_APPEND | O_CLOEXEC);
+  }
+  if (fdtrace == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("trace.h open");
+    writeErrorLog(fdlog_err, "trace.h: openTrace open failed");
+    return;
+  }
+
+  sprintf(metadata, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+      "\"args\":{\"name\":\"%s\"}},\n", getpid(), processName);
+  write(fdtrace, metadata, strlen(metadata));
+
+  isTracing = true;
+  traceFlushedNs = nowNs();
+  atexit(flushTrace);
+}
+
+// Start of a traced stage: pass the result to traceEnd()
+uint64_t traceBegin() {
+  return isTracing ? nowNs() : 0;
+}
+
+// End of a traced stage started at begin (name must be a string literal)
+void traceEnd(char *name, uint64_t begin) {
+  if (begin == 0 || isTraceRecording) {
+    return;
+  }
+
+  isTraceRecording = true;
+  // (the buffer is only touched between the flag's stores)
+  atomic_signal_fence(memory_order_seq_cst);
+  uint64_t end = nowNs();
+  traceEvents[traceCount].name = name;
+  traceEvents[traceCount].startNs = begin;
+  traceEvents[traceCount].durationNs = end - begin;
+  traceCount++;
+
+  if (traceCount == TRACE_EVENTS || end - traceFlushedNs > TRACE_FLUSH_NS) {
+    flushTrace();
+  }
+  atomic_signal_fence(memory_order_seq_cst);
+  isTraceRecording = false;
+}
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef MOMO_URING_H
+#define MOMO_URING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "common.h"
+
+/*
+  Minimal io_uring interface (raw system calls, no liburing) for the optional
+  io_uring backend, enabled by the MOMO_IO_URING environment variable. A
+  process queues several operations (writes, reads, a futex wait, a
+  timeout), then submits them and waits for their completions with a single
+  io_uring_enter() call, where the plain backend needs a system call each.
+  Kernels or sandboxes without io_uring, or without an operation a process
+  needs, are detected when the ring is opened: the process then keeps using
+  plain system calls.
+*/
+
+// (missing from older kernel headers: futex wait is from Linux 6.7)
+#define URING_OP_FUTEX_WAIT 51
+#define URING_FUTEX2_SIZE_U32 0x02
+#define URING_PROBE_OPS 256
+
+struct uring {
+  int fd;
+  unsigned entries;
+  // mappings of the rings and of the submission entries
+  void *rings;
+  size_t ringsSize;
+  size_t sqesSize;
+  // submission queue, shared with the kernel
+  _Atomic unsigned *sqHead;
+  _Atomic unsigned *sqTail;
+  unsigned sqMask;
+  unsigned *sqArray;
+  struct io_uring_sqe *sqes;
+  unsigned sqLocalTail; // queued, not yet made visible to the kernel
+  unsigned toSubmit;
+  // completion queue, shared with the kernel
+  _Atomic unsigned *cqHead;
+  _Atomic unsigned *cqTail;
+  unsigned cqMask;
+  struct io_uring_cqe *cqes;
+  bool hasExtArg; // io_uring_enter() takes a timeout
+};
+
+// Unmaps whatever openUring() mapped and closes the ring
+void closeUring(struct uring *ring) {
+  if (ring->rings != NULL && ring->rings != MAP_FAILED) {
+    munmap(ring->rings, ring->ringsSize);
+  }
+  if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+    munmap(ring->sqes, ring->sqesSize);
+  }
+  close(ring->fd);
+}
+
+// Sets the ring up, checking that the kernel supports the operations given
+// Returns false (with nothing left open) if io_uring cannot be used
+bool openUring(struct uring *ring, unsigned entries, int ops[], int count) {
+  struct io_uring_params params;
+  struct io_uring_probe *probe;
+  char *rings;
+  size_t sqSize;
+  size_t cqSize;
+
+  memset(ring, 0, sizeof(struct uring));
+  memset(&params, 0, sizeof(params));
+  ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd == -1) {
+    return false;
+  }
+
+  probe = calloc(1, sizeof(struct io_uring_probe) +
+      URING_PROBE_OPS * sizeof(struct io_uring_probe_op));
+  if (probe == NULL || syscall(__NR_io_uring_register, ring->fd,
+      IORING_REGISTER_PROBE, probe, URING_PROBE_OPS) == -1) {
+    free(probe);
+    close(ring->fd);
+    return false;
+  }
+  for (int i = 0; i < count; i++) {
+    if (ops[i] > probe->last_op ||
+        !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+      free(probe);
+      close(ring->fd);
+      return false;
+    }
+  }
+  free(probe);
+
+  // (one mapping for both rings on any kernel with the operations we need)
+  sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqSize = params.cq_off.cqes + params.cq_entries *
+      sizeof(struct io_uring_cqe);
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    close(ring->fd);
+    return false;
+  }
+  ring->ringsSize = sqSize > cqSize ? sqSize : cqSize;
+  ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->rings = mmap(NULL, ring->ringsSize, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->rings == MAP_FAILED || ring->sqes == MAP_FAILED) {
+    // (e.g. locked memory limit: plain system calls will do)
+    writeErrorLog(fdlog_err, "uring.h: openUring mmap failed");
+    closeUring(ring);
+    return false;
+  }
+  rings = ring->rings;
+
+  ring->entries = params.sq_entries;
+  ring->sqHead = (_Atomic unsigned *) (rings + params.sq_off.head);
+  ring->sqTail = (_Atomic unsigned *) (rings + params.sq_off.tail);
+  ring->sqMask = *(unsigned *) (rings + params.sq_off.ring_mask);
+  ring->sqArray = (unsigned *) (rings + params.sq_off.array);
+  ring->sqLocalTail = atomic_load(ring->sqTail);
+  ring->cqHead = (_Atomic unsigned *) (rings + params.cq_off.head);
+  ring->cqTail = (_Atomic unsigned *) (rings + params.cq_off.tail);
+  ring->cqMask = *(unsigned *) (rings + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) (rings + params.cq_off.cqes);
+  ring->hasExtArg = params.features & IORING_FEAT_EXT_ARG;
+
+  return true;
+}
+
+// Next free submission entry, cleared
+struct io_uring_sqe *getSqe(struct uring *ring) {
+  unsigned head = atomic_load_explicit(ring->sqHead, memory_order_acquire);
+  unsigned index = ring->sqLocalTail & ring->sqMask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+
+  if (ring->sqLocalTail - head >= ring->entries) {
+    writeErrorLog(fdlog_err, "uring.h: getSqe submission queue full");
+    exit(-1);
+  }
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  ring->sqArray[index] = index;
+  ring->sqLocalTail++;
+  ring->toSubmit++;
+
+  return sqe;
+}
+
+// Submits the queued entries and waits until waitFor completions are
+// available, or timeoutNs has passed (0: no timeout)
+// Returns false if interrupted by a signal or the timeout
+bool enterUring(struct uring *ring, unsigned waitFor, uint64_t timeoutNs) {
+  struct __kernel_timespec timeout = {timeoutNs / 1000000000ull,
+      timeoutNs % 1000000000ull};
+  struct io_uring_getevents_arg arg;
+  unsigned flags = waitFor > 0 ? IORING_ENTER_GETEVENTS : 0;
+  void *argp = NULL;
+  size_t argSize = 0;
+  long submitted;
+
+  if (timeoutNs > 0 && ring->hasExtArg) {
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uintptr_t) &timeout;
+    flags |= IORING_ENTER_EXT_ARG;
+    argp = &arg;
+    argSize = sizeof(arg);
+  }
+
+  atomic_store_explicit(ring->sqTail, ring->sqLocalTail, memory_order_release);
+  submitted = syscall(__NR_io_uring_enter, ring->fd, ring->toSubmit, waitFor,
+      flags, argp, argSize);
+  if (submitted == -1 && errno != EINTR && errno != ETIME) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("uring.h io_uring_enter");
+    writeErrorLog(fdlog_err, "uring.h: enterUring io_uring_enter failed");
+    exit(-1);
+  }
+  if (submitted > 0) {
+    ring->toSubmit -= submitted;
+  }
+
+  return submitted != -1;
+}
+
+// Takes the next completion, if any
+bool reapCqe(struct uring *ring, struct io_uring_cqe *cqe) {
+  unsigned head = atomic_load_explicit(ring->cqHead, memory_order_relaxed);
+
+  if (head == atomic_load_explicit(ring->cqTail, memory_order_acquire)) {
+    return false;
+  }
+  *cqe = ring->cqes[head & ring->cqMask];
+  atomic_store_explicit(ring->cqHead, head + 1, memory_order_release);
+
+  return true;
+}
+
+#endif
@@ -2,12 +2,24 @@
 echo Installing...
 # make bin/ directory for executables
 mkdir bin
-# compile source files & create executables, link math library
-gcc src/watchdog.c -lm -o bin/watchdog
-gcc src/commander.c -lm -o bin/commander
-gcc src/inspector.c -lm -o bin/inspector
-gcc src/motorx.c -lm -o bin/motorx
-gcc src/motorz.c -lm -o bin/motorz
+# compile source files & create executables, link math, zlib and pthread
+# libraries (zlib: log compression)
+gcc src/watchdog.c -lm -lz -lpthread -o bin/watchdog
+gcc src/commander.c -lm -lz -lpthread -o bin/commander
+gcc src/inspector.c -lm -lz -lpthread -o bin/inspector
+gcc src/motorx.c -lm -lz -lpthread -o bin/motorx
+gcc src/motorz.c -lm -lz -lpthread -o bin/motorz
+gcc src/momo-latency.c -lm -lz -lpthread -o bin/momo-latency
+gcc src/momo-ipcbench.c -lm -lrt -lz -lpthread -o bin/momo-ipcbench
+gcc src/momo-stat.c -lm -lz -lpthread -o bin/momo-stat
+gcc src/momo-loadgen.c -lm -lz -lpthread -o bin/momo-loadgen
+gcc src/momo-log.c -lm -lz -lpthread -o bin/momo-log
+gcc src/momo-jitter.c -lm -lz -lpthread -o bin/momo-jitter
+gcc src/momo-telemetry.c -lm -lz -lpthread -o bin/momo-telemetry
+gcc src/momo-control.c -lm -lz -lpthread -o bin/momo-control
+gcc src/momo-obstacles.c -lm -lz -lpthread -o bin/momo-obstacles
+gcc src/momo-fleetbench.c -lm -lz -lpthread -o bin/momo-fleetbench
+gcc src/momo-iobench.c -lm -lz -lpthread -o bin/momo-iobench
 touch run.sh
 chmod +x run.sh;
 # main executable script: run.sh
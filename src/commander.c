@@ -12,8 +12,8 @@ void signalHandler (int signum);
 pid_t pid_watchdog;
 pid_t pid_inspector;
 pid_t pid_inspector_sub;
-int fdx;
-int fdz;
+struct cmdChannel cmdx;
+struct cmdChannel cmdz;
 int fdlog_info;
 int fdlog_err;
 
@@ -29,6 +29,9 @@ int main (int argc, char** argv) {
   fdlog_info = openInfoLog();
   fdlog_err = openErrorLog();
 
+  openStats(STATS_COMMANDER);
+  openTrace("commander");
+
   writeInfoLog(fdlog_info, "Commander: booting up...");
   writeInfoLog(fdlog_info, "Commander: running");
 
@@ -37,9 +40,9 @@ int main (int argc, char** argv) {
   pid_inspector_sub = readPID("tmp/PID_inspector_sub");
   pid_inspector = readPID("tmp/PID_inspector");
 
-  // opening pipes for motors x and z
-  fdx = openPipeMotorComm("x");
-  fdz = openPipeMotorComm("z");
+  // mapping command rings for motors x and z
+  openMotorComm(&cmdx, "x", CMD_LANE_COMMANDER);
+  openMotorComm(&cmdz, "z", CMD_LANE_COMMANDER);
 
   while (1) {
     // detecting user keypresses to control hoist
@@ -49,42 +52,44 @@ int main (int argc, char** argv) {
     printInfo();
     printf("\n\n");
     int input = detectKeyPress();
+    // (a SIGUSR1 arriving meanwhile is handled once the key is)
+    blockCommandSignal(true);
 
     switch (input) {
       case 97:
         // a: go left
         kill(pid_watchdog, SIGUSR1);
-        commandMotor(fdx, -motorSpeedStep);
+        commandMotor(&cmdx, -motorSpeedStep);
         writeInfoLog(fdlog_info, "Commander: move left command sent");
         break;
       case 100:
         // d: go right
         kill(pid_watchdog, SIGUSR1);
-        commandMotor(fdx, motorSpeedStep);
+        commandMotor(&cmdx, motorSpeedStep);
         writeInfoLog(fdlog_info, "Commander: move right command sent");
         break;
       case 115:
         // s: go down
         kill(pid_watchdog, SIGUSR1);
-        commandMotor(fdz, motorSpeedStep);
+        commandMotor(&cmdz, motorSpeedStep);
         writeInfoLog(fdlog_info, "Commander: move down command sent");
         break;
       case 119:
         // w: go up
         kill(pid_watchdog, SIGUSR1);
-        commandMotor(fdz, -motorSpeedStep);
+        commandMotor(&cmdz, -motorSpeedStep);
         writeInfoLog(fdlog_info, "Commander: move up command sent");
         break;
       case 120:
         // x: stop motorx (non-emergency)
         kill(pid_watchdog, SIGUSR1);
-        commandMotor(fdx, 501);
+        commandMotor(&cmdx, 501);
         writeInfoLog(fdlog_info, "Commander: stop motorx command sent");
         break;
       case 122:
         // z: stop motorz (non-emergency)
         kill(pid_watchdog, SIGUSR1);
-        commandMotor(fdz, 501);
+        commandMotor(&cmdz, 501);
         writeInfoLog(fdlog_info, "Commander: stop motorz command sent");
         break;
       case 113: ;
@@ -92,15 +97,15 @@ int main (int argc, char** argv) {
         terminalColor(41, 1);
         printf("Commander: simulation SHUTDOWN in progress...");
         fflush(stdout);
-        commandMotor(fdx, 502);
-        commandMotor(fdz, 502);
+        commandMotor(&cmdx, 502);
+        commandMotor(&cmdz, 502);
         kill(pid_watchdog, SIGTERM);
         // inspector forked into two processes, kill both
         kill(pid_inspector, SIGTERM);
         kill(pid_inspector_sub, SIGTERM);
         writeInfoLog(fdlog_info, "Commander: shut down command sent");
-        closePipe(fdx);
-        closePipe(fdz);
+        closeMotorComm(&cmdx);
+        closeMotorComm(&cmdz);
         closeLog(fdlog_info);
         closeLog(fdlog_err);
         sleep(3);
@@ -109,6 +114,7 @@ int main (int argc, char** argv) {
         // ignore all other keys
         break;
     }
+    blockCommandSignal(false);
   }
 
   return -1;
@@ -159,15 +165,15 @@ void signalHandler (int signum) {
     terminalColor(41, 1);
     printf("Commander: simulation SHUTDOWN in progress...\n");
     fflush(stdout);
-    commandMotor(fdx, 502);
-    commandMotor(fdz, 502);
+    commandMotor(&cmdx, 502);
+    commandMotor(&cmdz, 502);
     kill(pid_watchdog, SIGTERM);
     // inspector forked into two processes, kill both
     kill(pid_inspector, SIGTERM);
     kill(pid_inspector_sub, SIGTERM);
     writeInfoLog(fdlog_info, "Commander: shut down command sent");
-    closePipe(fdx);
-    closePipe(fdz);
+    closeMotorComm(&cmdx);
+    closeMotorComm(&cmdz);
     closeLog(fdlog_info);
     closeLog(fdlog_err);
     sleep(3);
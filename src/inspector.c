@@ -1,6 +1,10 @@
 #include <signal.h>
+#include <poll.h>
+#include <sys/ioctl.h>
 
 #include "../include/command.h"
+#include "../include/estimator.h"
+#include "../include/history.h"
 
 /*
   The inspector outputs an estimate of the hoist/joist position in real time.
@@ -9,29 +13,70 @@
   The process forks into two:
   - the parent process always waits for emergency commands RESET and STOP
   - the child process keeps displaying coordinate information to terminal
+  The display runs at its own frame rate (MOMO_FPS, default 30), independent
+  of the motor cycle: every coordinate received goes through the state
+  estimator (see estimator.h), and the filtered position is kept with its
+  arrival time. Each frame shows the position interpolated between the
+  samples one cycle in the past or, with MOMO_EXTRAPOLATE set, extrapolated
+  from the latest sample with the estimated velocity (no delay, but
+  overshoots when the hoist stops).
+  Below the hoist, a strip chart per axis shows the filtered positions of the
+  last HISTORY_SECONDS, as the range they covered in each terminal column
+  (see history.h).
 */
 
+// default display frame rate
+#define FPS 30
+// samples kept per axis: enough to cover the interpolation delay
+#define SAMPLES 8
+// ends a line of the display, clearing what the previous frame left there
+#define NEWLINE "\033[K\n"
+// time shown by the strip charts
+#define HISTORY_SECONDS 10
+// rows of a strip chart
+#define CHART_ROWS 3
+// columns taken by a strip chart's labels
+#define CHART_LABEL 6
+
+struct axisTrack {
+  float positions[SAMPLES]; // filtered
+  uint64_t times[SAMPLES]; // arrival times
+  long count; // samples received so far
+  float velocity; // estimated, per cycle
+  float max;
+  struct positionHistory history;
+};
+
 void signalHandler (int signum);
 // graphical representation of the hoist
 void drawHoist(float coordx, float coordz, float downsizeFactor);
+// strip chart of the axis' recent positions
+void drawHistory(struct axisTrack *track, char *axis);
 // prints useful information (commands, current velocity, etc.)
-void printInfo(float coordx, float coordz);
+void printInfo(float coordx, float coordz, struct stateEstimator *estimator);
+// keeps a filtered coordinate received at the given time
+void addSample(struct axisTrack *track, float position, float velocity,
+    uint64_t time);
+// estimated position of the axis at the given time
+float trackPosition(struct axisTrack *track, uint64_t time, uint64_t cycleNs,
+    bool isExtrapolating);
 
-int fdmc_x;
-int fdmc_z;
+struct cmdChannel cmd_x;
+struct cmdChannel cmd_z;
 
 int main (int argc, char** argv) {
   pid_t pid_watchdog;
   pid_t pid_child;
   pid_t pid_motorx;
   pid_t pid_motorz;
-  float simulationSpeed = SIM_SPEED;
-  int fdlog_info;
-  int fdlog_err;
+  float simulationSpeed = getSimSpeed();
 
   fdlog_info = openInfoLog();
   fdlog_err = openErrorLog();
 
+  // (shared by the two inspector processes)
+  openStats(STATS_INSPECTOR);
+
   writeInfoLog(fdlog_info, "Inspector: booting up...");
   writeInfoLog(fdlog_info, "Inspector: running");
 
@@ -49,6 +94,8 @@ int main (int argc, char** argv) {
     // PARENT
     struct sigaction sa;
 
+    openTrace("inspector");
+
     // sending inspector subprocess PID to watchdog
     writePID("tmp/PID_inspector", false);
     // sending inspector subprocess PID to commander
@@ -56,9 +103,9 @@ int main (int argc, char** argv) {
     writeInfoLog(fdlog_info, "Inspector: sending PID to watchdog");
 
     writeInfoLog(fdlog_info, "Inspector: awaiting commands...");
-    // Opening pipes for motors x and z
-    fdmc_x = openPipeMotorComm("x");
-    fdmc_z = openPipeMotorComm("z");
+    // Mapping command rings for motors x and z
+    openMotorComm(&cmd_x, "x", CMD_LANE_INSPECTOR);
+    openMotorComm(&cmd_z, "z", CMD_LANE_INSPECTOR);
 
     memset(&sa, 0, sizeof(sa));
     sa.sa_handler = &signalHandler;
@@ -67,6 +114,8 @@ int main (int argc, char** argv) {
     while (1) {
       // Detecting user keypresses for RESET and EMERGENCY STOP buttons
       int input = detectKeyPress();
+      // (a SIGUSR1 arriving meanwhile is handled once the key is)
+      blockCommandSignal(true);
 
       switch (input) {
         case 32:
@@ -76,6 +125,11 @@ int main (int argc, char** argv) {
 
           writeInfoLog(fdlog_info, "Inspector: EMERGENCY STOP signal sent");
 
+          // the restarted motors resume from their checkpoint: queue a STOP
+          // first, so that they resume with zero velocity
+          commandMotor(&cmd_x, CMD_STOP);
+          commandMotor(&cmd_z, CMD_STOP);
+
           // immediately kill motorx and motorz (using SIGKILL for safety reasons:
           // the hoist must stop IMMEDIATELY) and then restart the two processes
           kill(pid_motorx, SIGKILL);
@@ -89,10 +143,14 @@ int main (int argc, char** argv) {
           char* arg_listz[] = {"./bin/motorz", NULL};
 
           if (fork() == 0) {
+            // (the mask would outlive the exec)
+            blockCommandSignal(false);
             execvp("./bin/motorx", arg_listx);
           }
 
           if (fork() == 0) {
+            // (the mask would outlive the exec)
+            blockCommandSignal(false);
             execvp("./bin/motorz", arg_listz);
           }
 
@@ -109,47 +167,207 @@ int main (int argc, char** argv) {
           kill(pid_watchdog, SIGUSR1);
           writeInfoLog(fdlog_info, "Inspector: RESET signal sent to motors");
 
-          commandMotor(fdmc_x, 500);
-          commandMotor(fdmc_z, 500);
+          commandMotor(&cmd_x, 500);
+          commandMotor(&cmd_z, 500);
           break;
         default:
           // Ignore all other keys
           break;
       }
+      blockCommandSignal(false);
     }
   } else {
     // CHILD
-    int fdmi_x;
-    int fdmi_z;
-    float coordx;
-    float coordz;
+    // (static: the histories are too large for the stack)
+    static struct axisTrack tracks[2];
+    struct stateEstimator estimator;
+    struct winsize terminal;
+    int chartWidth = 0;
+    struct pollfd fds[2];
+    struct coordinateReader reader;
+    bool isUring;
+    float coordinates[2][64];
+    int counts[2];
+    uint64_t cycleNs = simulationSpeed * 1000;
+    uint64_t frameNs = 1000000000ull / FPS;
+    bool isExtrapolating = getenv("MOMO_EXTRAPOLATE") != NULL;
+
+    if (getenv("MOMO_FPS") != NULL && atoi(getenv("MOMO_FPS")) > 0) {
+      frameNs = 1000000000ull / atoi(getenv("MOMO_FPS"));
+    }
+
+    openTrace("inspector display");
 
     // sending inspector subprocess PID to commander
     writePID("tmp/PID_inspector_sub", true);
 
-    fdmi_x = openPipeMotorInspector("x");
-    fdmi_z = openPipeMotorInspector("z");
+    memset(tracks, 0, sizeof(tracks));
+    initEstimator(&estimator);
+    tracks[0].max = MAX_X;
+    tracks[1].max = MAX_Z;
+    for (int i = 0; i < 2; i++) {
+      setHistoryWidth(&tracks[i].history, 1, HISTORY_SECONDS * 1000000000ull);
+    }
+    fds[0].fd = openPipeMotorInspector("x");
+    fds[1].fd = openPipeMotorInspector("z");
+    // (io_uring keeps a read queued on each pipe, which must block)
+    isUring = false;
+    if (getenv("MOMO_IO_URING") != NULL) {
+      isUring = openCoordinateReader(&reader, fds[0].fd, fds[1].fd);
+      if (isUring) {
+        writeInfoLog(fdlog_info, "Inspector: reading coordinates with "
+            "io_uring");
+      } else {
+        writeErrorLog(fdlog_err, "Inspector: io_uring unavailable, polling "
+            "the motor pipes");
+      }
+    }
+    for (int i = 0; i < 2; i++) {
+      fds[i].events = POLLIN;
+      if (!isUring) {
+        fcntl(fds[i].fd, F_SETFL, O_NONBLOCK);
+      }
+    }
+    holdPipeMotorInspector("x");
+    holdPipeMotorInspector("z");
+
+    // whole frames are written at once, drawn over the previous one
+    setvbuf(stdout, NULL, _IOFBF, BUFF_SIZE * 4);
+    clearTerminal();
 
+    uint64_t nextFrame = nowNs();
     while (1) {
-      clearTerminal();
-      coordx = readCoordinates(fdmi_x);
-      coordz = readCoordinates(fdmi_z);
+      // take in the coordinates that arrive until the frame is due
+      uint64_t now = nowNs();
+      while (now < nextFrame) {
+        int timeout = (nextFrame - now + 999999) / 1000000;
+        bool isReady;
+        if (isUring) {
+          isReady = readCoordinateReader(&reader, coordinates, counts,
+              nextFrame - now);
+        } else if ((isReady = poll(fds, 2, timeout) > 0)) {
+          for (int i = 0; i < 2; i++) {
+            counts[i] = fds[i].revents & POLLIN ?
+                readAvailableCoordinates(fds[i].fd, coordinates[i], 64) : 0;
+          }
+        }
+        if (isReady) {
+          uint64_t traceStage = traceBegin();
+          now = nowNs();
+          // (both axes at once, the n-th sample of each together)
+          for (int j = 0; j < counts[0] || j < counts[1]; j++) {
+            float measurements[2];
+            bool isMeasured[2];
+            for (int i = 0; i < 2; i++) {
+              isMeasured[i] = j < counts[i];
+              measurements[i] = isMeasured[i] ? coordinates[i][j] : 0;
+            }
+            updateEstimator(&estimator, measurements, isMeasured);
+            for (int i = 0; i < 2; i++) {
+              if (isMeasured[i]) {
+                addSample(&tracks[i], estimator.position[i],
+                    estimator.velocity[i], now);
+              }
+            }
+          }
+          traceEnd("coordinate read", traceStage);
+        }
+        now = nowNs();
+      }
+
+      uint64_t traceStage = traceBegin();
+      // fit the charts to the terminal (rebuilt only when it is resized)
+      if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &terminal) == 0 &&
+          terminal.ws_col > CHART_LABEL &&
+          terminal.ws_col - CHART_LABEL != chartWidth) {
+        chartWidth = terminal.ws_col - CHART_LABEL;
+        for (int i = 0; i < 2; i++) {
+          setHistoryWidth(&tracks[i].history, chartWidth,
+              HISTORY_SECONDS * 1000000000ull);
+        }
+      }
+      for (int i = 0; i < 2; i++) {
+        advanceHistory(&tracks[i].history, now);
+      }
+      float coordx = trackPosition(&tracks[0], now, cycleNs, isExtrapolating);
+      float coordz = trackPosition(&tracks[1], now, cycleNs, isExtrapolating);
+      printf("\033[H");
       printIntro("Inspector");
-      printf("\n");
+      printf(NEWLINE);
       drawHoist(coordx, coordz, 1.5f);
-      printf("\n\n");
-      printInfo(coordx, coordz);
+      printf(NEWLINE NEWLINE);
+      drawHistory(&tracks[0], "X");
+      drawHistory(&tracks[1], "Z");
+      printf(NEWLINE);
+      printInfo(coordx, coordz, &estimator);
+      printf("\033[J");
+      fflush(stdout);
+      traceEnd("render", traceStage);
+      countStat(&stats->ticks, 1);
+      recordLatency(&stats->tickDuration, nowNs() - now);
+
+      nextFrame += frameNs;
+      if (nextFrame < now) {
+        // (fell behind, e.g. suspended terminal: do not catch up)
+        nextFrame = now + frameNs;
+      }
+    }
+  }
+}
+
+void addSample(struct axisTrack *track, float position, float velocity,
+    uint64_t time) {
+  // (the filter may overshoot the ends of the track)
+  position = position < 0 ? 0 : position > track->max ? track->max : position;
+  track->positions[track->count % SAMPLES] = position;
+  track->velocity = velocity;
+  addHistorySample(&track->history, position, time);
+  track->times[track->count % SAMPLES] = time;
+  track->count++;
+}
+
+float trackPosition(struct axisTrack *track, uint64_t time, uint64_t cycleNs,
+    bool isExtrapolating) {
+  long latest = track->count - 1;
 
-      usleep(simulationSpeed);
+  if (track->count == 0) {
+    return 0;
+  }
+
+  if (isExtrapolating) {
+    float position = track->positions[latest % SAMPLES];
+    // no further than one cycle: the motor may have stopped since
+    uint64_t elapsed = time - track->times[latest % SAMPLES];
+    elapsed = elapsed < cycleNs ? elapsed : cycleNs;
+    position += track->velocity * elapsed / cycleNs;
+    return position < 0 ? 0 : position > track->max ? track->max : position;
+  }
+
+  // interpolate one cycle in the past, where samples exist on both sides
+  uint64_t shown = time - cycleNs;
+  long oldest = track->count > SAMPLES ? track->count - SAMPLES : 0;
+  for (long i = latest; i > oldest; i--) {
+    uint64_t after = track->times[i % SAMPLES];
+    uint64_t before = track->times[(i - 1) % SAMPLES];
+    if (before <= shown) {
+      if (shown >= after) {
+        // no newer sample yet: hold the latest
+        return track->positions[i % SAMPLES];
+      }
+      float from = track->positions[(i - 1) % SAMPLES];
+      float to = track->positions[i % SAMPLES];
+      return from + (to - from) * (shown - before) / (after - before);
     }
   }
+
+  return track->positions[oldest % SAMPLES];
 }
 
 void signalHandler (int signum) {
   if (signum == SIGUSR1) {
     // RESET
-    commandMotor(fdmc_x, 500);
-    commandMotor(fdmc_z, 500);
+    commandMotor(&cmd_x, 500);
+    commandMotor(&cmd_z, 500);
   }
 }
 
@@ -179,29 +397,51 @@ void drawHoist(float coordx, float coordz, float downsizeFactor) {
   // drawing the Z axis and the hoist hook
   for (int i = 0; i < posZ; i++) {
     // printing spaces to align hook to hoist body
-    printf("\n%*s", (int) posX, "");
+    printf(NEWLINE "%*s", (int) posX, "");
     // track, or "cable"
     printf("|");
   }
 
   // hook is the last thing to print
   terminalColor(33, true);
-  printf("\n%*s", (int) posX, "");
+  printf(NEWLINE "%*s", (int) posX, "");
   printf("J");
 
   // show lowest point hook can go
   terminalColor(30, 1);
   for (int i = posZ; i < MAX_Z/(downsizeFactorZ); i++) {
-    printf("\n");
+    printf(NEWLINE);
   }
   for (int i = 0; i < MAX_X/downsizeFactorX; i++) {
     printf("_");
   }
+}
 
-  fflush(stdout);
+void drawHistory(struct axisTrack *track, char *axis) {
+  struct positionHistory *history = &track->history;
+
+  for (int row = 0; row < CHART_ROWS; row++) {
+    // positions shown on this row
+    float top = track->max * (CHART_ROWS - row) / CHART_ROWS;
+    float bottom = track->max * (CHART_ROWS - row - 1) / CHART_ROWS;
+
+    terminalColor(37, false);
+    printf("%s %3.0f ", row == 0 ? axis : " ", top);
+    terminalColor(36, true);
+    // oldest column first
+    for (int i = 1; i <= history->width; i++) {
+      int slot = (history->lastColumn + i) % history->width;
+      float min = history->columnMin[slot];
+      float max = history->columnMax[slot];
+      bool isCovered = max >= bottom && (min < top || (row == 0 && min <= top));
+      putchar(isCovered ? '|' : ' ');
+    }
+    printf(NEWLINE);
+  }
+  terminalColor(0, false);
 }
 
-void printInfo(float coordx, float coordz) {
+void printInfo(float coordx, float coordz, struct stateEstimator *estimator) {
   terminalColor(31, true);
   printf("RESET HOIST: ");
   terminalColor(37, true);
@@ -219,5 +459,14 @@ void printInfo(float coordx, float coordz) {
   printf(" | ");
   printf("Z: %.1f", coordz);
 
-  fflush(stdout);
+  // estimator output: velocity per cycle, then the innovations' mean and
+  // deviation against the deviation the filter expects
+  terminalColor(37, false);
+  for (int i = 0; i < 2; i++) {
+    printf(NEWLINE "%s: velocity %+6.2f | innovation %+.2f (mean %+.3f, "
+        "sd %.3f, expected %.3f)", i == 0 ? "X" : "Z",
+        estimator->velocity[i], estimator->innovation[i], estimator->mean[i],
+        innovationDeviation(estimator, i), sqrt(estimator->spread[i]));
+  }
+  terminalColor(0, false);
 }
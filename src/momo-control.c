@@ -0,0 +1,583 @@
+#include <getopt.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../include/command.h"
+#include "../include/checkpoint.h"
+#include "../include/control.h"
+#include "../include/bench.h"
+
+/*
+  Control server for programmatic commanding (see control.h for the
+  protocol). With -S, it listens on tmp/control.sock and multiplexes any
+  number of clients with epoll: every request read in one round of events is
+  validated, turned into motor commands and published as one batch per motor
+  (one command ring update, at most one wakeup), then every client gets its
+  replies in one write. A client that does not read its replies stops being
+  read from until it does.
+  Otherwise, momo-control is a client: it sends one request given on the
+  command line and prints the reply, or with -b benchmarks the server with a
+  stream of pipelined MOVE requests.
+*/
+
+#define CLIENTS_MAX 1024
+// requests read from a client at once
+#define CLIENT_REQUESTS 64
+#define BATCH_REQUESTS (CLIENTS_MAX * 4)
+#define CLIENT_REPLIES 256
+// lane slots kept for STOP, RESET and SHUTDOWN (per round of events), so
+// that other requests filling the lane never get them refused
+#define URGENT_SLOTS 16
+
+struct client {
+  int fd;
+  char input[CLIENT_REQUESTS * sizeof(struct controlRequest)];
+  int inputLength;
+  struct controlReply output[CLIENT_REPLIES];
+  int outputStart;
+  int outputCount;
+  int pending; // requests of the current batch, not replied to yet
+  bool isReading; // EPOLLIN requested
+  bool isWaitingOutput; // EPOLLOUT requested
+  bool isClosed;
+};
+
+struct pendingRequest {
+  struct client *client;
+  struct controlRequest request;
+  uint64_t receivedNs;
+};
+
+struct client *clients[CLIENTS_MAX];
+struct pendingRequest batch[BATCH_REQUESTS];
+int batchCount = 0;
+struct cmdChannel channels[2];
+struct motorCheckpoint *checkpoints[2];
+int epollFd;
+
+void printUsage();
+
+void watchClient(struct client *client) {
+  struct epoll_event event;
+  // stop reading requests while there is no room for their replies
+  bool isReading = client->outputCount + client->pending +
+      CLIENT_REQUESTS <= CLIENT_REPLIES;
+
+  if (isReading == client->isReading &&
+      (client->outputCount > 0) == client->isWaitingOutput) {
+    return;
+  }
+  client->isReading = isReading;
+  client->isWaitingOutput = client->outputCount > 0;
+  event.events = EPOLLRDHUP | (isReading ? EPOLLIN : 0) |
+      (client->isWaitingOutput ? EPOLLOUT : 0);
+  event.data.fd = client->fd;
+  epoll_ctl(epollFd, EPOLL_CTL_MOD, client->fd, &event);
+}
+
+void removeClient(struct client *client) {
+  // (closing also removes it from the epoll set)
+  close(client->fd);
+  clients[client->fd] = NULL;
+  free(client);
+}
+
+void acceptClients(int listenFd) {
+  struct epoll_event event;
+  int fd;
+
+  while ((fd = accept(listenFd, NULL, NULL)) != -1) {
+    if (fd >= CLIENTS_MAX) {
+      close(fd);
+      writeErrorLog(fdlog_err, "Control: too many clients");
+      continue;
+    }
+
+    struct client *client = calloc(1, sizeof(struct client));
+    client->fd = fd;
+    client->isReading = true;
+    clients[fd] = client;
+
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = fd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+  }
+}
+
+// Reads the client's requests into the batch
+void readRequests(struct client *client) {
+  int room = CLIENT_REPLIES - client->outputCount - client->pending;
+  int size = sizeof(struct controlRequest);
+  int wanted = (room < CLIENT_REQUESTS ? room : CLIENT_REQUESTS) * size -
+      client->inputLength;
+  uint64_t now = nowNs();
+  int offset = 0;
+
+  if (wanted <= 0 || batchCount == BATCH_REQUESTS) {
+    return;
+  }
+
+  ssize_t length = read(client->fd, client->input + client->inputLength,
+      wanted);
+  if (length == 0 || (length == -1 && errno != EAGAIN)) {
+    client->isClosed = true;
+    return;
+  } else if (length == -1) {
+    return;
+  }
+  client->inputLength += length;
+
+  while (client->inputLength - offset >= size &&
+      batchCount < BATCH_REQUESTS) {
+    batch[batchCount].client = client;
+    memcpy(&batch[batchCount].request, client->input + offset, size);
+    batch[batchCount].receivedNs = now;
+    batchCount++;
+    client->pending++;
+    offset += size;
+  }
+  memmove(client->input, client->input + offset,
+      client->inputLength - offset);
+  client->inputLength -= offset;
+}
+
+// Writes as many queued replies as the socket takes without blocking
+void flushReplies(struct client *client) {
+  while (client->outputCount > 0) {
+    int count = client->outputStart + client->outputCount > CLIENT_REPLIES ?
+        CLIENT_REPLIES - client->outputStart : client->outputCount;
+    ssize_t length = write(client->fd, &client->output[client->outputStart],
+        count * sizeof(struct controlReply));
+
+    if (length == -1) {
+      if (errno != EAGAIN) {
+        client->isClosed = true;
+      }
+      break;
+    }
+    // (sockets take whole replies here: they are far smaller than a page,
+    // and a short write only happens when the buffer is nearly full)
+    int written = length / sizeof(struct controlReply);
+    if (length % sizeof(struct controlReply) != 0) {
+      client->isClosed = true;
+      writeErrorLog(fdlog_err, "Control: short reply write, client dropped");
+      break;
+    }
+    client->outputStart = (client->outputStart + written) % CLIENT_REPLIES;
+    client->outputCount -= written;
+    if (written < count) {
+      break;
+    }
+  }
+
+  if (!client->isClosed) {
+    watchClient(client);
+  }
+}
+
+// Motor commands for a request, or -1 if the request is invalid
+int requestCommands(struct controlRequest *request, float commands[]) {
+  if (request->axis > CONTROL_AXIS_BOTH) {
+    return -1;
+  }
+
+  switch (request->op) {
+    case CONTROL_MOVE:
+    case CONTROL_VELOCITY:
+      if (!isfinite(request->value) ||
+          fabs(request->value) > CONTROL_MAX_VELOCITY) {
+        return -1;
+      }
+      if (request->op == CONTROL_MOVE) {
+        commands[0] = request->value;
+        return 1;
+      }
+      // stop, then accelerate to the velocity
+      commands[0] = CMD_STOP;
+      commands[1] = request->value;
+      return request->value == 0 ? 1 : 2;
+    case CONTROL_STOP:
+      commands[0] = CMD_STOP;
+      return 1;
+    case CONTROL_RESET:
+      commands[0] = CMD_RESET;
+      return 1;
+    case CONTROL_SHUTDOWN:
+      commands[0] = CMD_SHUTDOWN;
+      return 1;
+    case CONTROL_QUERY:
+      return 0;
+    default:
+      return -1;
+  }
+}
+
+// Publishes the commands of the whole batch, then queues the replies
+void processBatch() {
+  float commands[2][CMD_RING_SLOTS];
+  int counts[2] = {0, 0};
+  uint32_t space[2] = {cmdLaneSpace(&channels[0]), cmdLaneSpace(&channels[1])};
+  bool isFull[2] = {false, false};
+  uint8_t statuses[BATCH_REQUESTS];
+
+  for (int i = 0; i < batchCount; i++) {
+    struct controlRequest *request = &batch[i].request;
+    float requested[2];
+    int count = requestCommands(request, requested);
+    bool isUrgent = request->op == CONTROL_STOP ||
+        request->op == CONTROL_RESET || request->op == CONTROL_SHUTDOWN;
+
+    if (count == -1) {
+      statuses[i] = CONTROL_INVALID;
+      continue;
+    }
+
+    // all or nothing: a request is never applied to one axis only
+    statuses[i] = CONTROL_OK;
+    for (int axis = 0; axis < 2; axis++) {
+      if ((request->axis == axis || request->axis == CONTROL_AXIS_BOTH) &&
+          counts[axis] + count + (isUrgent ? 0 : URGENT_SLOTS) >
+          space[axis]) {
+        statuses[i] = CONTROL_BUSY;
+        isFull[axis] = true;
+      }
+    }
+    if (statuses[i] == CONTROL_BUSY) {
+      continue;
+    }
+    for (int axis = 0; axis < 2; axis++) {
+      if (request->axis == axis || request->axis == CONTROL_AXIS_BOTH) {
+        memcpy(&commands[axis][counts[axis]], requested,
+            count * sizeof(float));
+        counts[axis] += count;
+      }
+    }
+  }
+
+  // (always fits: the motors only ever free up space in the meantime)
+  for (int axis = 0; axis < 2; axis++) {
+    if (counts[axis] > 0) {
+      tryPublishCommands(&channels[axis], commands[axis], counts[axis]);
+    }
+    // a full lane is drained now rather than at the motor's next tick
+    if (isFull[axis]) {
+      wakeMotor(channels[axis].ring);
+    }
+  }
+  uint64_t publishedNs = nowNs();
+
+  struct checkpointRecord states[2];
+  bool isKnown[2] = {readCheckpoint(checkpoints[0], &states[0]),
+      readCheckpoint(checkpoints[1], &states[1])};
+  for (int i = 0; i < batchCount; i++) {
+    struct client *client = batch[i].client;
+    struct controlReply *reply = &client->output[(client->outputStart +
+        client->outputCount) % CLIENT_REPLIES];
+
+    memset(reply, 0, sizeof(struct controlReply));
+    reply->id = batch[i].request.id;
+    reply->op = batch[i].request.op;
+    reply->status = statuses[i];
+    reply->latencyNs = publishedNs - batch[i].receivedNs;
+    for (int axis = 0; axis < 2; axis++) {
+      if (isKnown[axis]) {
+        reply->position[axis] = states[axis].position;
+        reply->velocity[axis] = states[axis].currentSpeed;
+      }
+    }
+    client->outputCount++;
+    client->pending--;
+  }
+
+  for (int i = 0; i < batchCount; i++) {
+    struct client *client = batch[i].client;
+    if (client->pending == 0 && !client->isClosed) {
+      // (once per client: its replies are all queued now)
+      client->pending = -1;
+      flushReplies(client);
+    }
+  }
+  for (int i = 0; i < batchCount; i++) {
+    if (batch[i].client->pending == -1) {
+      batch[i].client->pending = 0;
+    }
+  }
+  batchCount = 0;
+}
+
+void serve() {
+  struct sockaddr_un address;
+  struct epoll_event event;
+  struct epoll_event events[64];
+  int listenFd;
+
+  openMotorComm(&channels[0], "x", CMD_LANE_CONTROL);
+  openMotorComm(&channels[1], "z", CMD_LANE_CONTROL);
+  checkpoints[0] = openCheckpoint("x");
+  checkpoints[1] = openCheckpoint("z");
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, CONTROL_SOCKET);
+  // (stale: a running server holds the lanes, so this one would have exited
+  // in openMotorComm)
+  unlink(CONTROL_SOCKET);
+  listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (listenFd == -1 || epollFd == -1 ||
+      bind(listenFd, (struct sockaddr *) &address, sizeof(address)) == -1 ||
+      listen(listenFd, 64) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("momo-control socket");
+    writeErrorLog(fdlog_err, "Control: serve socket setup failed");
+    exit(-1);
+  }
+
+  event.events = EPOLLIN;
+  event.data.fd = listenFd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+
+  printf("momo-control: serving on %s\n", CONTROL_SOCKET);
+  fflush(stdout);
+  writeInfoLog(fdlog_info, "Control: running");
+
+  while (1) {
+    int count = epoll_wait(epollFd, events, 64, -1);
+
+    for (int i = 0; i < count; i++) {
+      int fd = events[i].data.fd;
+      struct client *client = clients[fd];
+
+      if (fd == listenFd) {
+        acceptClients(listenFd);
+      } else if (client != NULL) {
+        if (events[i].events & EPOLLOUT) {
+          flushReplies(client);
+        }
+        if (events[i].events & EPOLLIN) {
+          readRequests(client);
+        } else if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+          client->isClosed = true;
+        }
+      }
+    }
+
+    processBatch();
+    for (int fd = 0; fd < CLIENTS_MAX; fd++) {
+      if (clients[fd] != NULL && clients[fd]->isClosed) {
+        removeClient(clients[fd]);
+      }
+    }
+  }
+}
+
+int connectControl() {
+  struct sockaddr_un address;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, CONTROL_SOCKET);
+  if (fd == -1 ||
+      connect(fd, (struct sockaddr *) &address, sizeof(address)) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("momo-control connect");
+    exit(-1);
+  }
+
+  return fd;
+}
+
+// Reads exactly length bytes
+void readAll(int fd, void *buffer, size_t length) {
+  size_t done = 0;
+
+  while (done < length) {
+    ssize_t count = read(fd, (char *) buffer + done, length - done);
+    if (count <= 0) {
+      printf("momo-control: connection closed by the server\n");
+      exit(-1);
+    }
+    done += count;
+  }
+}
+
+// Sends one request and prints its reply
+void request(int op, int axis, float value) {
+  struct controlRequest request = {1, op, axis, 0, value};
+  struct controlReply reply;
+  char *statuses[] = {"ok", "invalid", "busy"};
+  int fd = connectControl();
+  uint64_t start = nowNs();
+
+  if (write(fd, &request, sizeof(request)) != sizeof(request)) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("momo-control write");
+    exit(-1);
+  }
+  readAll(fd, &reply, sizeof(reply));
+
+  printf("%s in %.1f us (server %.1f us) | X: %.1f (velocity %.1f) | "
+      "Z: %.1f (velocity %.1f)\n", statuses[reply.status % 3],
+      (nowNs() - start) / 1e3, reply.latencyNs / 1e3, reply.position[0],
+      reply.velocity[0], reply.position[1], reply.velocity[1]);
+  close(fd);
+  exit(reply.status == CONTROL_OK ? 0 : -1);
+}
+
+// Sends count MOVE requests (alternately +1 and -1 on x), keeping window of
+// them in flight, and reports round trip and server latencies
+void benchmark(int count, int window) {
+  uint64_t *sentNs = malloc(count * sizeof(uint64_t));
+  uint64_t *roundTrips = malloc(count * sizeof(uint64_t));
+  uint64_t *serverLatencies = malloc(count * sizeof(uint64_t));
+  struct controlReply replies[CLIENT_REQUESTS];
+  int fd = connectControl();
+  int sent = 0;
+  int received = 0;
+  int busy = 0;
+  uint64_t start = nowNs();
+
+  while (received < count) {
+    // top the window up, in one write
+    struct controlRequest requests[CLIENT_REQUESTS];
+    int batchSize = 0;
+    while (sent < count && sent - received < window &&
+        batchSize < CLIENT_REQUESTS) {
+      struct controlRequest request = {sent, CONTROL_MOVE, CONTROL_AXIS_X, 0,
+          sent % 2 == 0 ? 1 : -1};
+      requests[batchSize++] = request;
+      sentNs[sent++] = nowNs();
+    }
+    if (batchSize > 0 && write(fd, requests, batchSize *
+        sizeof(struct controlRequest)) == -1) {
+      printf("Error %d in ", errno);
+      fflush(stdout);
+      perror("momo-control write");
+      exit(-1);
+    }
+
+    // at least one reply, and whatever else already arrived
+    int ready = sent - received < CLIENT_REQUESTS ?
+        sent - received : CLIENT_REQUESTS;
+    ssize_t length = read(fd, replies, ready * sizeof(struct controlReply));
+    if (length <= 0) {
+      printf("momo-control: connection closed by the server\n");
+      exit(-1);
+    }
+    int remainder = length % sizeof(struct controlReply);
+    if (remainder != 0) {
+      readAll(fd, (char *) replies + length,
+          sizeof(struct controlReply) - remainder);
+      length += sizeof(struct controlReply) - remainder;
+    }
+
+    uint64_t now = nowNs();
+    for (int i = 0; i < length / sizeof(struct controlReply); i++) {
+      roundTrips[received] = now - sentNs[replies[i].id];
+      serverLatencies[received] = replies[i].latencyNs;
+      busy += replies[i].status == CONTROL_BUSY;
+      received++;
+    }
+  }
+  double elapsed = (nowNs() - start) / 1e9;
+
+  printf("momo-control: %d MOVE requests, %d in flight, %d busy\n", count,
+      window, busy);
+  printLatencySummary("round trip", roundTrips, count);
+  printLatencySummary("server queueing", serverLatencies, count);
+  printf("throughput %.0f requests/s\n", count / elapsed);
+  close(fd);
+}
+
+int main (int argc, char** argv) {
+  char *ops[] = {"", "move", "velocity", "stop", "reset", "shutdown", "query"};
+  bool isServing = false;
+  int benchCount = 0;
+  int window = 1;
+  int option;
+
+  // (+: stop at the operation, so that negative values are not options)
+  while ((option = getopt(argc, argv, "+Sb:w:h")) != -1) {
+    switch (option) {
+      case 'S':
+        isServing = true;
+        break;
+      case 'b':
+        benchCount = atoi(optarg);
+        break;
+      case 'w':
+        window = atoi(optarg);
+        break;
+      default:
+        printUsage();
+        exit(option == 'h' ? 0 : -1);
+    }
+  }
+  if (window < 1) {
+    printUsage();
+    exit(-1);
+  }
+
+  fdlog_info = openInfoLog();
+  fdlog_err = openErrorLog();
+  // a client that disconnects must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+
+  if (isServing) {
+    writeInfoLog(fdlog_info, "Control: booting up...");
+    serve();
+  } else if (benchCount > 0) {
+    benchmark(benchCount, window);
+  } else if (optind < argc) {
+    int op = 0;
+    int axis = CONTROL_AXIS_BOTH;
+    float value = 0;
+
+    for (int i = 1; i <= CONTROL_QUERY; i++) {
+      if (strcmp(argv[optind], ops[i]) == 0) {
+        op = i;
+      }
+    }
+    if (op == CONTROL_MOVE || op == CONTROL_VELOCITY) {
+      if (argc - optind != 3) {
+        printUsage();
+        exit(-1);
+      }
+      value = atof(argv[optind + 2]);
+    }
+    if (optind + 1 < argc) {
+      axis = strcmp(argv[optind + 1], "x") == 0 ? CONTROL_AXIS_X :
+          strcmp(argv[optind + 1], "z") == 0 ? CONTROL_AXIS_Z :
+          strcmp(argv[optind + 1], "both") == 0 ? CONTROL_AXIS_BOTH : -1;
+    }
+    if (op == 0 || axis == -1) {
+      printUsage();
+      exit(-1);
+    }
+    request(op, axis, value);
+  } else {
+    printUsage();
+    exit(-1);
+  }
+
+  closeLog(fdlog_info);
+  closeLog(fdlog_err);
+  return 0;
+}
+
+void printUsage() {
+  printf("usage: momo-control -S\n"
+      "       momo-control move|velocity x|z|both value\n"
+      "       momo-control stop|reset|shutdown|query [x|z|both]\n"
+      "       momo-control -b count [-w window]\n"
+      "  -S  serve the control socket (%s)\n"
+      "  -b  benchmark the server with count pipelined MOVE requests\n"
+      "  -w  requests in flight during the benchmark (default 1)\n",
+      CONTROL_SOCKET);
+}
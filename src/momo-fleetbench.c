@@ -0,0 +1,226 @@
+#include <getopt.h>
+
+#include "../include/spatialhash.h"
+#include "../include/bench.h"
+
+/*
+  Benchmark of near-collision detection between the hooks of a fleet of
+  hoists sharing a yard. Every tick, each hook moves like a motor would (a
+  velocity changed now and then by a command, bouncing off the yard's
+  edges), then the hooks closer than the collision distance are found: with
+  the spatial hash (updated in place, see spatialhash.h), and for comparison
+  by testing every pair, whose results also check the hash's. The yard grows
+  with the fleet to keep the given density (hooks per 100 x 100 track units,
+  the range of one hoist).
+*/
+
+#define DEFAULT_COUNTS "10,100,1000,10000,100000"
+#define DEFAULT_DENSITIES "1,10,50"
+// largest fleet tested pair by pair (by default)
+#define PAIRWISE_MAX 20000
+#define PAIRS_MAX 1000000
+
+void printUsage();
+
+struct fleet {
+  int count;
+  float side; // of the square yard
+  float *x;
+  float *z;
+  float *velocityX;
+  float *velocityZ;
+};
+
+void createFleet(struct fleet *fleet, int count, float density) {
+  fleet->count = count;
+  fleet->side = 100 * sqrtf(count / density);
+  fleet->x = malloc(count * sizeof(float));
+  fleet->z = malloc(count * sizeof(float));
+  fleet->velocityX = malloc(count * sizeof(float));
+  fleet->velocityZ = malloc(count * sizeof(float));
+
+  for (int i = 0; i < count; i++) {
+    fleet->x[i] = (float) rand() / RAND_MAX * fleet->side;
+    fleet->z[i] = (float) rand() / RAND_MAX * fleet->side;
+    fleet->velocityX[i] = 0;
+    fleet->velocityZ[i] = 0;
+  }
+}
+
+void freeFleet(struct fleet *fleet) {
+  free(fleet->x);
+  free(fleet->z);
+  free(fleet->velocityX);
+  free(fleet->velocityZ);
+}
+
+// One tick of motion: a command for about 1 hook in 20, then a step
+void moveFleet(struct fleet *fleet) {
+  for (int i = 0; i < fleet->count; i++) {
+    if (rand() % 20 == 0) {
+      fleet->velocityX[i] = fminf(fmaxf(fleet->velocityX[i] +
+          rand() % 3 - 1, -3), 3);
+      fleet->velocityZ[i] = fminf(fmaxf(fleet->velocityZ[i] +
+          rand() % 3 - 1, -3), 3);
+    }
+    fleet->x[i] += fleet->velocityX[i];
+    fleet->z[i] += fleet->velocityZ[i];
+    if (fleet->x[i] < 0 || fleet->x[i] > fleet->side) {
+      fleet->velocityX[i] = -fleet->velocityX[i];
+      fleet->x[i] = fminf(fmaxf(fleet->x[i], 0), fleet->side);
+    }
+    if (fleet->z[i] < 0 || fleet->z[i] > fleet->side) {
+      fleet->velocityZ[i] = -fleet->velocityZ[i];
+      fleet->z[i] = fminf(fmaxf(fleet->z[i], 0), fleet->side);
+    }
+  }
+}
+
+long findNearPairs(struct fleet *fleet, float distance) {
+  float limit = distance * distance;
+  long found = 0;
+
+  for (int i = 0; i < fleet->count; i++) {
+    for (int j = i + 1; j < fleet->count; j++) {
+      float dx = fleet->x[j] - fleet->x[i];
+      float dz = fleet->z[j] - fleet->z[i];
+      found += dx * dx + dz * dz < limit;
+    }
+  }
+
+  return found;
+}
+
+int main (int argc, char** argv) {
+  char counts[256] = DEFAULT_COUNTS;
+  char densities[256] = DEFAULT_DENSITIES;
+  float distance = 2;
+  int ticks = 100;
+  int pairwiseMax = PAIRWISE_MAX;
+  int option;
+
+  while ((option = getopt(argc, argv, "n:d:r:t:p:h")) != -1) {
+    switch (option) {
+      case 'n':
+        snprintf(counts, sizeof(counts), "%s", optarg);
+        break;
+      case 'd':
+        snprintf(densities, sizeof(densities), "%s", optarg);
+        break;
+      case 'r':
+        distance = atof(optarg);
+        break;
+      case 't':
+        ticks = atoi(optarg);
+        break;
+      case 'p':
+        pairwiseMax = atoi(optarg);
+        break;
+      default:
+        printUsage();
+        exit(option == 'h' ? 0 : -1);
+    }
+  }
+  if (distance <= 0 || ticks <= 0) {
+    printUsage();
+    exit(-1);
+  }
+
+  fdlog_info = openInfoLog();
+  fdlog_err = openErrorLog();
+
+  struct hookPair *pairs = malloc(PAIRS_MAX * sizeof(struct hookPair));
+  printf("momo-fleetbench: %d ticks, collision distance %.1f\n", ticks,
+      distance);
+  printf("%8s %8s %12s %12s %12s %12s %10s\n", "hooks", "density",
+      "pairs/tick", "update us", "query us", "pairwise us", "speedup");
+
+  char *saveCount;
+  for (char *count = strtok_r(counts, ",", &saveCount); count != NULL;
+      count = strtok_r(NULL, ",", &saveCount)) {
+    char densityList[256];
+    char *saveDensity;
+
+    // (strtok_r cuts the list: a fresh copy for every count)
+    snprintf(densityList, sizeof(densityList), "%s", densities);
+    for (char *density = strtok_r(densityList, ",", &saveDensity);
+        density != NULL; density = strtok_r(NULL, ",", &saveDensity)) {
+      struct fleet fleet;
+      struct spatialHash hash;
+      uint64_t updateNs = 0;
+      uint64_t queryNs = 0;
+      uint64_t pairwiseNs = 0;
+      long found = 0;
+      bool isPairwise = atoi(count) <= pairwiseMax;
+
+      if (atoi(count) <= 0 || atof(density) <= 0) {
+        printUsage();
+        exit(-1);
+      }
+
+      srand(1);
+      createFleet(&fleet, atoi(count), atof(density));
+      initSpatialHash(&hash, fleet.count, distance);
+      for (int i = 0; i < fleet.count; i++) {
+        addHook(&hash, fleet.x[i], fleet.z[i]);
+      }
+
+      for (int tick = 0; tick < ticks; tick++) {
+        moveFleet(&fleet);
+
+        uint64_t start = nowNs();
+        for (int i = 0; i < fleet.count; i++) {
+          moveHook(&hash, i, fleet.x[i], fleet.z[i]);
+        }
+        uint64_t updated = nowNs();
+        long tickPairs = findNearHooks(&hash, distance, pairs, PAIRS_MAX);
+        uint64_t queried = nowNs();
+        updateNs += updated - start;
+        queryNs += queried - updated;
+        found += tickPairs;
+
+        if (isPairwise) {
+          long expected = findNearPairs(&fleet, distance);
+          pairwiseNs += nowNs() - queried;
+          if (expected != tickPairs) {
+            printf("momo-fleetbench: the hash found %ld pairs instead of "
+                "%ld\n", tickPairs, expected);
+            exit(-1);
+          }
+        }
+      }
+
+      printf("%8d %8s %12.1f %12.1f %12.1f", fleet.count, density,
+          (double) found / ticks, updateNs / 1e3 / ticks,
+          queryNs / 1e3 / ticks);
+      if (isPairwise) {
+        printf(" %12.1f %9.1fx\n", pairwiseNs / 1e3 / ticks,
+            (double) pairwiseNs / (updateNs + queryNs));
+      } else {
+        printf(" %12s %10s\n", "-", "-");
+      }
+      fflush(stdout);
+
+      freeSpatialHash(&hash);
+      freeFleet(&fleet);
+    }
+  }
+
+  free(pairs);
+  closeLog(fdlog_info);
+  closeLog(fdlog_err);
+  return 0;
+}
+
+void printUsage() {
+  printf("usage: momo-fleetbench [-n counts] [-d densities] [-r distance] "
+      "[-t ticks] [-p max]\n"
+      "  times near-collision detection between the hooks of a fleet, with\n"
+      "  the spatial hash and pair by pair\n"
+      "  -n  comma-separated hook counts (default %s)\n"
+      "  -d  comma-separated densities, hooks per 100x100 (default %s)\n"
+      "  -r  collision distance (default 2)\n"
+      "  -t  ticks per run (default 100)\n"
+      "  -p  largest fleet also checked pair by pair (default %d)\n",
+      DEFAULT_COUNTS, DEFAULT_DENSITIES, PAIRWISE_MAX);
+}
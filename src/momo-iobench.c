@@ -0,0 +1,400 @@
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "../include/command.h"
+#include "../include/bench.h"
+
+/*
+  Benchmark of the motors' I/O backends: runs a real motor headless (like
+  momo-latency, in a scratch directory, playing the watchdog and the
+  inspector itself) with plain system calls, then with io_uring
+  (MOMO_IO_URING, see uring.h), and reports for each the system calls the
+  motor makes per tick, by name, and the CPU time it takes per tick.
+  CPU time comes from /proc/<pid>/task/<tid>/schedstat (so it includes the
+  kernel's share, and the io_uring workers, which are threads of the motor)
+  over a window of ticks after a warmup. System calls are counted in a
+  second run, whose motor is traced with ptrace by a tracer process (tracing
+  slows it down, so that run is not timed): the tracer counts the system
+  calls between the SIGUSR1 and SIGUSR2 we send it at both ends of the
+  window, then sends the counts back through a pipe.
+*/
+
+#define SYSCALLS_MAX 512
+// system calls listed by name (the others by number)
+#define SYSCALL_NAMES 12
+
+void printUsage();
+
+struct ioResult {
+  double cpuNsPerTick;
+  double perTick[SYSCALLS_MAX]; // system calls per tick, by number
+  double totalPerTick;
+};
+
+volatile sig_atomic_t isCounting = false;
+volatile sig_atomic_t isReporting = false;
+
+void countHandler(int signum) {
+  if (signum == SIGUSR1) {
+    isCounting = true;
+  } else {
+    isReporting = true;
+  }
+}
+
+char *syscallName(int number) {
+  static char unknown[32];
+  int numbers[SYSCALL_NAMES] = {SYS_read, SYS_write, SYS_futex,
+      SYS_io_uring_enter, SYS_clock_gettime, SYS_clock_nanosleep, SYS_ppoll,
+      SYS_openat, SYS_close, SYS_flock, SYS_lseek, SYS_newfstatat};
+  char *names[SYSCALL_NAMES] = {"read", "write", "futex", "io_uring_enter",
+      "clock_gettime", "clock_nanosleep", "ppoll", "openat", "close", "flock",
+      "lseek", "newfstatat"};
+
+  for (int i = 0; i < SYSCALL_NAMES; i++) {
+    if (numbers[i] == number) {
+      return names[i];
+    }
+  }
+  snprintf(unknown, sizeof(unknown), "syscall %d", number);
+  return unknown;
+}
+
+// CPU time of every thread of the process, in nanoseconds
+uint64_t processCpuNs(pid_t pid) {
+  char path[PATH_MAX];
+  uint64_t total = 0;
+  DIR *dir;
+  struct dirent *entry;
+
+  snprintf(path, sizeof(path), "/proc/%d/task", pid);
+  dir = opendir(path);
+  if (dir == NULL) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("momo-iobench motor tasks");
+    exit(-1);
+  }
+  while ((entry = readdir(dir)) != NULL) {
+    unsigned long long ns;
+    FILE *file;
+
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    snprintf(path, sizeof(path), "/proc/%d/task/%s/schedstat", pid,
+        entry->d_name);
+    file = fopen(path, "r");
+    // (a thread may exit in between)
+    if (file != NULL && fscanf(file, "%llu", &ns) == 1) {
+      total += ns;
+    }
+    if (file != NULL) {
+      fclose(file);
+    }
+  }
+  closedir(dir);
+
+  return total;
+}
+
+// Tracer process: runs the motor under ptrace, counting its system calls
+// between SIGUSR1 and SIGUSR2, then writes the counts to fdCounts
+void traceMotor(char *motorBinary, int fdCounts) {
+  static long counts[SYSCALLS_MAX];
+  struct sigaction action;
+  int status;
+
+  // (no SA_RESTART: the signals interrupt waitpid)
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = countHandler;
+  sigaction(SIGUSR1, &action, NULL);
+  sigaction(SIGUSR2, &action, NULL);
+
+  pid_t pid_motor = fork();
+  if (pid_motor == 0) {
+    char* arg_list[] = {motorBinary, NULL};
+    ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+    raise(SIGSTOP);
+    execv(motorBinary, arg_list);
+    perror("momo-iobench motor exec");
+    exit(-1);
+  }
+
+  waitpid(pid_motor, &status, 0);
+  if (ptrace(PTRACE_SETOPTIONS, pid_motor, NULL,
+      PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("momo-iobench ptrace");
+    kill(pid_motor, SIGKILL);
+    exit(-1);
+  }
+  ptrace(PTRACE_SYSCALL, pid_motor, NULL, 0);
+
+  while (1) {
+    if (isReporting) {
+      if (write(fdCounts, counts, sizeof(counts)) == -1) {
+        perror("momo-iobench counts write");
+      }
+      isReporting = false;
+      isCounting = false;
+    }
+    if (waitpid(pid_motor, &status, 0) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      break;
+    }
+
+    int signal = 0;
+    if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+      struct __ptrace_syscall_info info;
+      if (isCounting && ptrace(PTRACE_GET_SYSCALL_INFO, pid_motor,
+          sizeof(info), &info) > 0 && info.op == PTRACE_SYSCALL_INFO_ENTRY &&
+          info.entry.nr < SYSCALLS_MAX) {
+        counts[info.entry.nr]++;
+      }
+    } else if (WSTOPSIG(status) != SIGTRAP) {
+      // (a signal for the motor, not a ptrace event)
+      signal = WSTOPSIG(status);
+    }
+    ptrace(PTRACE_SYSCALL, pid_motor, NULL, signal);
+  }
+
+  exit(0);
+}
+
+// Runs the motor for warmup then ticks ticks, sending a no-op command every
+// commandTicks ticks (0: never), and measures its CPU time, or (isTraced)
+// its system calls
+void runMotor(char *motorBinary, char *axis, bool isTraced, int warmup,
+    int ticks, int commandTicks, struct ioResult *result) {
+  int fdCounts[2];
+  pid_t pid_child;
+
+  if (isTraced && pipe(fdCounts) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("momo-iobench pipe");
+    exit(-1);
+  }
+
+  pid_child = fork();
+  if (pid_child == 0) {
+    if (isTraced) {
+      close(fdCounts[0]);
+      traceMotor(motorBinary, fdCounts[1]);
+    }
+    char* arg_list[] = {motorBinary, NULL};
+    execv(motorBinary, arg_list);
+    perror("momo-iobench motor exec");
+    exit(-1);
+  }
+
+  // motor boot handshake: we are its watchdog and its inspector
+  writePID("tmp/PID_watchdog", true);
+  pid_t pid_motor = readPID(strcmp(axis, "x") == 0 ? "tmp/PID_motorx" :
+      "tmp/PID_motorz");
+  int fdInspector = openPipeMotorInspector(axis);
+  struct cmdChannel commands;
+  openMotorComm(&commands, axis, CMD_LANE_COMMANDER);
+
+  for (int i = 0; i < warmup; i++) {
+    readCoordinates(fdInspector);
+  }
+
+  uint64_t startNs = processCpuNs(pid_motor);
+  if (isTraced) {
+    kill(pid_child, SIGUSR1);
+  }
+  for (int i = 0; i < ticks; i++) {
+    if (commandTicks > 0 && i % commandTicks == 0) {
+      commandMotor(&commands, 0);
+    }
+    readCoordinates(fdInspector);
+  }
+  uint64_t endNs = processCpuNs(pid_motor);
+
+  memset(result->perTick, 0, sizeof(result->perTick));
+  result->totalPerTick = 0;
+  result->cpuNsPerTick = (double) (endNs - startNs) / ticks;
+  if (isTraced) {
+    static long counts[SYSCALLS_MAX];
+    size_t got = 0;
+
+    kill(pid_child, SIGUSR2);
+    while (got < sizeof(counts)) {
+      ssize_t length = read(fdCounts[0], (char *) counts + got,
+          sizeof(counts) - got);
+      if (length <= 0) {
+        printf("momo-iobench: no system call counts from the tracer\n");
+        exit(-1);
+      }
+      got += length;
+    }
+    for (int i = 0; i < SYSCALLS_MAX; i++) {
+      result->perTick[i] = (double) counts[i] / ticks;
+      result->totalPerTick += result->perTick[i];
+    }
+    close(fdCounts[0]);
+    close(fdCounts[1]);
+  }
+
+  // (the motor keeps writing until it reads SHUTDOWN: keep draining)
+  commandMotor(&commands, CMD_SHUTDOWN);
+  fcntl(fdInspector, F_SETFL, O_NONBLOCK);
+  while (waitpid(pid_child, NULL, WNOHANG) == 0) {
+    float drained[64];
+    readAvailableCoordinates(fdInspector, drained, 64);
+    usleep(1000);
+  }
+  closeMotorComm(&commands);
+  closePipeMotorInspector(fdInspector);
+}
+
+int main (int argc, char** argv) {
+  int ticks = 2000;
+  int warmup = 100;
+  int commandTicks = 0;
+  long simSpeed = 1000;
+  char *axis = "x";
+  char *motorPath = NULL;
+  bool isKeeping = false;
+  char motorBinary[PATH_MAX];
+  char scratchDir[] = "/tmp/momo-iobench-XXXXXX";
+  char simSpeedValue[32];
+  char *backends[2] = {"plain", "io_uring"};
+  struct ioResult cpu[2];
+  struct ioResult calls[2];
+  int option;
+
+  while ((option = getopt(argc, argv, "n:w:t:c:a:m:kh")) != -1) {
+    switch (option) {
+      case 'n':
+        ticks = atoi(optarg);
+        break;
+      case 'w':
+        warmup = atoi(optarg);
+        break;
+      case 't':
+        simSpeed = atol(optarg);
+        break;
+      case 'c':
+        commandTicks = atoi(optarg);
+        break;
+      case 'a':
+        axis = optarg;
+        break;
+      case 'm':
+        motorPath = optarg;
+        break;
+      case 'k':
+        isKeeping = true;
+        break;
+      default:
+        printUsage();
+        exit(option == 'h' ? 0 : -1);
+    }
+  }
+
+  if (ticks <= 0 || warmup < 0 || simSpeed <= 0 || commandTicks < 0 ||
+      (strcmp(axis, "x") != 0 && strcmp(axis, "z") != 0)) {
+    printUsage();
+    exit(-1);
+  }
+
+  // locate the motor binary before leaving the repository directory
+  if (motorPath == NULL) {
+    motorPath = strcmp(axis, "x") == 0 ? "bin/motorx" : "bin/motorz";
+  }
+  if (realpath(motorPath, motorBinary) == NULL) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("momo-iobench motor binary");
+    exit(-1);
+  }
+
+  // scratch directory: isolates our pipes and logs from a live simulation
+  if (mkdtemp(scratchDir) == NULL || chdir(scratchDir) == -1 ||
+      mkdir("tmp", 0777) == -1 || mkdir("logs", 0777) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("momo-iobench scratch directory");
+    exit(-1);
+  }
+
+  fdlog_info = openInfoLog();
+  fdlog_err = openErrorLog();
+
+  sprintf(simSpeedValue, "%ld", simSpeed);
+  setenv("MOMO_SIM_SPEED", simSpeedValue, 1);
+
+  printf("momo-iobench: axis %s, tick %ld us, %d ticks measured after %d, ",
+      axis, simSpeed, ticks, warmup);
+  if (commandTicks > 0) {
+    printf("a command every %d ticks\n", commandTicks);
+  } else {
+    printf("no commands\n");
+  }
+  fflush(stdout);
+
+  for (int i = 0; i < 2; i++) {
+    if (i == 1) {
+      setenv("MOMO_IO_URING", "1", 1);
+    } else {
+      unsetenv("MOMO_IO_URING");
+    }
+    runMotor(motorBinary, axis, false, warmup, ticks, commandTicks, &cpu[i]);
+    runMotor(motorBinary, axis, true, warmup, ticks, commandTicks, &calls[i]);
+  }
+
+  closeLog(fdlog_info);
+  closeLog(fdlog_err);
+
+  printf("%-16s %12s %12s\n", "system calls", backends[0], backends[1]);
+  for (int number = 0; number < SYSCALLS_MAX; number++) {
+    if (calls[0].perTick[number] >= 0.005 ||
+        calls[1].perTick[number] >= 0.005) {
+      printf("%-16s %12.2f %12.2f\n", syscallName(number),
+          calls[0].perTick[number], calls[1].perTick[number]);
+    }
+  }
+  printf("%-16s %12.2f %12.2f  per tick\n", "total", calls[0].totalPerTick,
+      calls[1].totalPerTick);
+  printf("%-16s %12.2f %12.2f  us per tick\n", "CPU time",
+      cpu[0].cpuNsPerTick / 1000, cpu[1].cpuNsPerTick / 1000);
+  if (calls[1].perTick[SYS_io_uring_enter] == 0) {
+    printf("(io_uring unavailable: the motor used plain system calls, see "
+        "logs/errors.log with -k)\n");
+  }
+
+  if (isKeeping) {
+    printf("scratch directory kept: %s\n", scratchDir);
+  } else {
+    removeScratchDir(scratchDir);
+  }
+
+  return 0;
+}
+
+void printUsage() {
+  printf("usage: momo-iobench [-n ticks] [-w warmup] [-t tick_us] "
+      "[-c ticks] [-a x|z] [-m motor binary] [-k]\n"
+      "  compares the system calls and CPU time per tick of a motor with\n"
+      "  plain system calls and with io_uring (MOMO_IO_URING)\n"
+      "  -n  ticks measured (default 2000)\n"
+      "  -w  ticks before the measure (default 100)\n"
+      "  -t  motor tick period in microseconds (default 1000)\n"
+      "  -c  a no-op velocity command every so many ticks (default none)\n"
+      "  -a  axis to benchmark (default x)\n"
+      "  -m  motor binary (default bin/motorx or bin/motorz)\n"
+      "  -k  keep the scratch directory (tmp/ and logs/ of the runs)\n");
+}
@@ -0,0 +1,533 @@
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <mqueue.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include "../include/cmdring.h"
+#include "../include/bench.h"
+
+/*
+  IPC transport microbenchmark suite: measures round-trip latency (ping-pong
+  between two processes) and one-way throughput of the transports MOMO uses,
+  or could use, at the sizes of its payloads: 4 bytes (one velocity command)
+  and 8 bytes (one X/Z coordinate pair).
+  - fifo: named FIFOs, created and opened like the motor/inspector pipes
+  - uds-stream, uds-dgram: Unix domain socket pairs
+  - eventfd: semaphore-mode eventfd (wakeup only, carries no payload)
+  - mqueue: POSIX message queues
+  - shm-futex: shared-memory SPSC ring, futex wakeup when the peer sleeps
+  - signal: queued real-time signals (payload in the sigval, <= 8 bytes)
+*/
+
+#define MAX_MESSAGE 64
+#define SHM_SLOTS 256
+#define DEFAULT_SIZES "4,8"
+
+// one direction of the shared-memory transport
+struct shmRing {
+  _Atomic uint32_t head;
+  _Atomic uint32_t isConsumerWaiting;
+  char padHead[56];
+  _Atomic uint32_t tail;
+  _Atomic uint32_t isProducerWaiting;
+  char padTail[56];
+  char slots[SHM_SLOTS][MAX_MESSAGE];
+};
+
+// one side of a bidirectional channel
+struct endpoint {
+  int side; // 0: parent, 1: child
+  int sendFd;
+  int recvFd;
+  mqd_t sendQueue;
+  mqd_t recvQueue;
+  struct shmRing *sendRing;
+  struct shmRing *recvRing;
+  pid_t peer;
+};
+
+struct transport {
+  char *name;
+  int maxSize;
+  // before fork(): creates what both processes inherit
+  void (*create)(struct endpoint ends[2], int size);
+  // after fork(): finishes opening one side
+  void (*attach)(struct endpoint *end);
+  void (*send)(struct endpoint *end, char *message, int size);
+  void (*receive)(struct endpoint *end, char *message, int size);
+};
+
+char scratchDir[] = "/tmp/momo-ipcbench-XXXXXX";
+
+void fail(char *what) {
+  printf("Error %d in ", errno);
+  fflush(stdout);
+  perror(what);
+  exit(-1);
+}
+
+void writeAll(int fd, char *message, int size) {
+  while (size > 0) {
+    ssize_t written = write(fd, message, size);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fail("momo-ipcbench write");
+    }
+    message += written;
+    size -= written;
+  }
+}
+
+void readAll(int fd, char *message, int size) {
+  while (size > 0) {
+    ssize_t count = read(fd, message, size);
+    if (count == -1 && errno == EINTR) {
+      continue;
+    } else if (count <= 0) {
+      fail("momo-ipcbench read");
+    }
+    message += count;
+    size -= count;
+  }
+}
+
+void fdSend(struct endpoint *end, char *message, int size) {
+  writeAll(end->sendFd, message, size);
+}
+
+void fdReceive(struct endpoint *end, char *message, int size) {
+  readAll(end->recvFd, message, size);
+}
+
+// named FIFOs (mkfifo + blocking open, like the inspector pipes)
+void fifoCreate(struct endpoint ends[2], int size) {
+  char path[PATH_MAX];
+
+  for (int i = 0; i < 2; i++) {
+    sprintf(path, "%s/fifo_%d", scratchDir, i);
+    if (mkfifo(path, 0666) == -1 && errno != EEXIST) {
+      fail("momo-ipcbench mkfifo");
+    }
+  }
+}
+
+void fifoAttach(struct endpoint *end) {
+  char path[PATH_MAX];
+
+  // fifo_0 carries parent -> child, fifo_1 child -> parent: opening them in
+  // the same order on both sides avoids the open() rendezvous deadlock
+  sprintf(path, "%s/fifo_0", scratchDir);
+  if (end->side == 0) {
+    end->sendFd = open(path, O_WRONLY);
+  } else {
+    end->recvFd = open(path, O_RDONLY);
+  }
+  sprintf(path, "%s/fifo_1", scratchDir);
+  if (end->side == 0) {
+    end->recvFd = open(path, O_RDONLY);
+  } else {
+    end->sendFd = open(path, O_WRONLY);
+  }
+  if (end->sendFd == -1 || end->recvFd == -1) {
+    fail("momo-ipcbench fifo open");
+  }
+}
+
+void noAttach(struct endpoint *end) {
+}
+
+// Unix domain socket pairs
+void socketCreate(struct endpoint ends[2], int type) {
+  int fds[2];
+
+  if (socketpair(AF_UNIX, type, 0, fds) == -1) {
+    fail("momo-ipcbench socketpair");
+  }
+  ends[0].sendFd = ends[0].recvFd = fds[0];
+  ends[1].sendFd = ends[1].recvFd = fds[1];
+}
+
+void udsStreamCreate(struct endpoint ends[2], int size) {
+  socketCreate(ends, SOCK_STREAM);
+}
+
+void udsDgramCreate(struct endpoint ends[2], int size) {
+  socketCreate(ends, SOCK_DGRAM);
+}
+
+void udsDgramSend(struct endpoint *end, char *message, int size) {
+  while (send(end->sendFd, message, size, 0) == -1) {
+    if (errno != EINTR && errno != ENOBUFS && errno != EAGAIN) {
+      fail("momo-ipcbench send");
+    }
+  }
+}
+
+void udsDgramReceive(struct endpoint *end, char *message, int size) {
+  while (recv(end->recvFd, message, size, 0) == -1) {
+    if (errno != EINTR) {
+      fail("momo-ipcbench recv");
+    }
+  }
+}
+
+// eventfd in semaphore mode: every read consumes exactly one write
+void eventfdCreate(struct endpoint ends[2], int size) {
+  int toChild = eventfd(0, EFD_SEMAPHORE);
+  int toParent = eventfd(0, EFD_SEMAPHORE);
+
+  if (toChild == -1 || toParent == -1) {
+    fail("momo-ipcbench eventfd");
+  }
+  ends[0].sendFd = ends[1].recvFd = toChild;
+  ends[1].sendFd = ends[0].recvFd = toParent;
+}
+
+void eventfdSend(struct endpoint *end, char *message, int size) {
+  uint64_t one = 1;
+  writeAll(end->sendFd, (char *) &one, sizeof(one));
+}
+
+void eventfdReceive(struct endpoint *end, char *message, int size) {
+  uint64_t value;
+  readAll(end->recvFd, (char *) &value, sizeof(value));
+}
+
+// POSIX message queues
+void mqueueCreate(struct endpoint ends[2], int size) {
+  struct mq_attr attr;
+  char name[64];
+  mqd_t queues[2];
+
+  memset(&attr, 0, sizeof(attr));
+  attr.mq_maxmsg = 10; // default /proc/sys/fs/mqueue/msg_max
+  attr.mq_msgsize = size;
+
+  for (int i = 0; i < 2; i++) {
+    sprintf(name, "/momo-ipcbench-%d-%d", getpid(), i);
+    queues[i] = mq_open(name, O_RDWR | O_CREAT | O_EXCL, 0600, &attr);
+    if (queues[i] == (mqd_t) -1) {
+      fail("momo-ipcbench mq_open");
+    }
+    // both processes inherit the descriptors: the names are not needed
+    mq_unlink(name);
+  }
+  ends[0].sendQueue = ends[1].recvQueue = queues[0];
+  ends[1].sendQueue = ends[0].recvQueue = queues[1];
+}
+
+void mqueueSend(struct endpoint *end, char *message, int size) {
+  while (mq_send(end->sendQueue, message, size, 0) == -1) {
+    if (errno != EINTR) {
+      fail("momo-ipcbench mq_send");
+    }
+  }
+}
+
+void mqueueReceive(struct endpoint *end, char *message, int size) {
+  char buffer[MAX_MESSAGE];
+
+  while (mq_receive(end->recvQueue, buffer, size, NULL) == -1) {
+    if (errno != EINTR) {
+      fail("momo-ipcbench mq_receive");
+    }
+  }
+  memcpy(message, buffer, size);
+}
+
+// shared-memory SPSC rings: no syscall unless the peer sleeps
+void shmCreate(struct endpoint ends[2], int size) {
+  struct shmRing *rings = mmap(NULL, 2 * sizeof(struct shmRing),
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (rings == MAP_FAILED) {
+    fail("momo-ipcbench mmap");
+  }
+  ends[0].sendRing = ends[1].recvRing = &rings[0];
+  ends[1].sendRing = ends[0].recvRing = &rings[1];
+}
+
+void shmSend(struct endpoint *end, char *message, int size) {
+  struct shmRing *ring = end->sendRing;
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t tail;
+
+  while (head - (tail = atomic_load_explicit(&ring->tail,
+      memory_order_acquire)) >= SHM_SLOTS) {
+    atomic_store_explicit(&ring->isProducerWaiting, 1, memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->tail, memory_order_seq_cst) == tail) {
+      futex(&ring->tail, FUTEX_WAIT, tail, NULL, 0);
+    }
+  }
+
+  memcpy(ring->slots[head & (SHM_SLOTS - 1)], message, size);
+  atomic_store_explicit(&ring->head, head + 1, memory_order_seq_cst);
+
+  if (atomic_load_explicit(&ring->isConsumerWaiting, memory_order_seq_cst)) {
+    atomic_store_explicit(&ring->isConsumerWaiting, 0, memory_order_relaxed);
+    futex(&ring->head, FUTEX_WAKE, 1, NULL, 0);
+  }
+}
+
+void shmReceive(struct endpoint *end, char *message, int size) {
+  struct shmRing *ring = end->recvRing;
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint32_t head;
+
+  while ((head = atomic_load_explicit(&ring->head, memory_order_acquire))
+      == tail) {
+    atomic_store_explicit(&ring->isConsumerWaiting, 1, memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->head, memory_order_seq_cst) == tail) {
+      futex(&ring->head, FUTEX_WAIT, tail, NULL, 0);
+    }
+  }
+
+  memcpy(message, ring->slots[tail & (SHM_SLOTS - 1)], size);
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_seq_cst);
+
+  if (atomic_load_explicit(&ring->isProducerWaiting, memory_order_seq_cst)) {
+    atomic_store_explicit(&ring->isProducerWaiting, 0, memory_order_relaxed);
+    futex(&ring->tail, FUTEX_WAKE, 1, NULL, 0);
+  }
+}
+
+// queued real-time signals, payload carried in the sigval
+void signalCreate(struct endpoint ends[2], int size) {
+  sigset_t set;
+
+  // blocked before fork(): the child inherits the mask, nothing is lost
+  sigemptyset(&set);
+  sigaddset(&set, SIGRTMIN);
+  sigprocmask(SIG_BLOCK, &set, NULL);
+}
+
+void signalAttach(struct endpoint *end) {
+  if (end->side == 1) {
+    end->peer = getppid();
+  }
+}
+
+void signalSend(struct endpoint *end, char *message, int size) {
+  union sigval value;
+
+  memset(&value, 0, sizeof(value));
+  memcpy(&value, message, size);
+  while (sigqueue(end->peer, SIGRTMIN, value) == -1) {
+    if (errno != EAGAIN) {
+      fail("momo-ipcbench sigqueue");
+    }
+    // per-user queue of pending signals is full
+    sched_yield();
+  }
+}
+
+void signalReceive(struct endpoint *end, char *message, int size) {
+  sigset_t set;
+  siginfo_t info;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGRTMIN);
+  while (sigwaitinfo(&set, &info) == -1) {
+    if (errno != EINTR) {
+      fail("momo-ipcbench sigwaitinfo");
+    }
+  }
+  memcpy(message, &info.si_value, size);
+}
+
+struct transport transports[] = {
+  {"fifo", MAX_MESSAGE, fifoCreate, fifoAttach, fdSend, fdReceive},
+  {"uds-stream", MAX_MESSAGE, udsStreamCreate, noAttach, fdSend, fdReceive},
+  {"uds-dgram", MAX_MESSAGE, udsDgramCreate, noAttach, udsDgramSend,
+      udsDgramReceive},
+  {"eventfd", MAX_MESSAGE, eventfdCreate, noAttach, eventfdSend,
+      eventfdReceive},
+  {"mqueue", MAX_MESSAGE, mqueueCreate, noAttach, mqueueSend, mqueueReceive},
+  {"shm-futex", MAX_MESSAGE, shmCreate, noAttach, shmSend, shmReceive},
+  {"signal", sizeof(union sigval), signalCreate, signalAttach, signalSend,
+      signalReceive},
+};
+
+#define TRANSPORTS (sizeof(transports) / sizeof(transports[0]))
+
+void printUsage();
+
+// Runs the ping-pong and the streaming test of one transport at one size
+void runBenchmark(struct transport *t, int size, int rounds, int messages) {
+  struct endpoint ends[2];
+  char message[MAX_MESSAGE];
+  uint64_t *samples = malloc(rounds * sizeof(uint64_t));
+  int warmup = rounds / 10 + 1;
+
+  memset(ends, 0, sizeof(ends));
+  memset(message, 0x5a, sizeof(message));
+  ends[0].side = 0;
+  ends[1].side = 1;
+  t->create(ends, size);
+
+  pid_t pid_child = fork();
+  if (pid_child == -1) {
+    fail("momo-ipcbench fork");
+  }
+
+  if (pid_child == 0) {
+    // CHILD: echoes the ping-pong, then sinks the stream and acknowledges
+    struct endpoint *end = &ends[1];
+    t->attach(end);
+    for (int i = 0; i < warmup + rounds; i++) {
+      t->receive(end, message, size);
+      t->send(end, message, size);
+    }
+    for (int i = 0; i < messages; i++) {
+      t->receive(end, message, size);
+    }
+    t->send(end, message, size);
+    exit(0);
+  }
+
+  // PARENT
+  struct endpoint *end = &ends[0];
+  end->peer = pid_child;
+  t->attach(end);
+
+  for (int i = 0; i < warmup + rounds; i++) {
+    uint64_t start = nowNs();
+    t->send(end, message, size);
+    t->receive(end, message, size);
+    if (i >= warmup) {
+      samples[i - warmup] = nowNs() - start;
+    }
+  }
+
+  uint64_t start = nowNs();
+  for (int i = 0; i < messages; i++) {
+    t->send(end, message, size);
+  }
+  t->receive(end, message, size);
+  double elapsed = (nowNs() - start) / 1e9;
+
+  waitpid(pid_child, NULL, 0);
+
+  qsort(samples, rounds, sizeof(uint64_t), compareSamples);
+  printf("%-11s %5dB %10.2f %10.2f %10.2f %10.2f %14.0f %10.2f\n", t->name,
+      size, percentile(samples, rounds, 50) / 1000.0,
+      percentile(samples, rounds, 99) / 1000.0,
+      percentile(samples, rounds, 99.9) / 1000.0,
+      percentile(samples, rounds, 100) / 1000.0, messages / elapsed,
+      messages * (double) size / elapsed / (1024 * 1024));
+  fflush(stdout);
+
+  // release what create() and attach() made (the child's copies died with it)
+  int fds[4] = {ends[0].sendFd, ends[0].recvFd, ends[1].sendFd,
+      ends[1].recvFd};
+  for (int i = 0; i < 4; i++) {
+    bool isDuplicate = false;
+    for (int j = 0; j < i; j++) {
+      isDuplicate = isDuplicate || fds[j] == fds[i];
+    }
+    if (fds[i] > 0 && !isDuplicate) {
+      close(fds[i]);
+    }
+  }
+  if (ends[0].sendQueue > 0) {
+    mq_close(ends[0].sendQueue);
+    mq_close(ends[0].recvQueue);
+  }
+  if (ends[0].sendRing != NULL) {
+    munmap(ends[1].sendRing < ends[0].sendRing ? ends[1].sendRing :
+        ends[0].sendRing, 2 * sizeof(struct shmRing));
+  }
+  free(samples);
+}
+
+int main (int argc, char** argv) {
+  int rounds = 10000;
+  int messages = 100000;
+  char *only = NULL;
+  char sizesList[256] = DEFAULT_SIZES;
+  int option;
+
+  while ((option = getopt(argc, argv, "n:m:s:t:h")) != -1) {
+    switch (option) {
+      case 'n':
+        rounds = atoi(optarg);
+        break;
+      case 'm':
+        messages = atoi(optarg);
+        break;
+      case 's':
+        snprintf(sizesList, sizeof(sizesList), "%s", optarg);
+        break;
+      case 't':
+        only = optarg;
+        break;
+      default:
+        printUsage();
+        exit(option == 'h' ? 0 : -1);
+    }
+  }
+  if (rounds <= 0 || messages <= 0) {
+    printUsage();
+    exit(-1);
+  }
+
+  if (mkdtemp(scratchDir) == NULL) {
+    fail("momo-ipcbench mkdtemp");
+  }
+
+  printf("momo-ipcbench: %d round trips, %d streamed messages per test\n",
+      rounds, messages);
+  printf("%-11s %6s %10s %10s %10s %10s %14s %10s\n", "transport", "size",
+      "rtt p50", "p99", "p99.9", "max (us)", "stream msg/s", "MB/s");
+  // (flushed before fork(), or the children print it again)
+  fflush(stdout);
+
+  for (char *token = strtok(sizesList, ","); token != NULL;
+      token = strtok(NULL, ",")) {
+    int size = atoi(token);
+
+    if (size <= 0 || size > MAX_MESSAGE) {
+      printf("momo-ipcbench: size %s out of range (1-%d)\n", token,
+          MAX_MESSAGE);
+      continue;
+    }
+    for (int i = 0; i < TRANSPORTS; i++) {
+      if (only != NULL && strstr(only, transports[i].name) == NULL) {
+        continue;
+      }
+      if (size > transports[i].maxSize) {
+        printf("%-11s %5dB (payload too large for this transport)\n",
+            transports[i].name, size);
+        continue;
+      }
+      runBenchmark(&transports[i], size, rounds, messages);
+    }
+  }
+
+  for (int i = 0; i < 2; i++) {
+    char path[PATH_MAX];
+    sprintf(path, "%s/fifo_%d", scratchDir, i);
+    unlink(path);
+  }
+  rmdir(scratchDir);
+
+  return 0;
+}
+
+void printUsage() {
+  printf("usage: momo-ipcbench [-n round trips] [-m messages] [-s sizes] "
+      "[-t transports]\n"
+      "  -n  ping-pong round trips per test (default 10000)\n"
+      "  -m  messages streamed one way per test (default 100000)\n"
+      "  -s  comma-separated message sizes in bytes (default " DEFAULT_SIZES
+      ", max %d)\n"
+      "  -t  comma-separated transports to run (default all): fifo,\n"
+      "      uds-stream, uds-dgram, eventfd, mqueue, shm-futex, signal\n",
+      MAX_MESSAGE);
+}
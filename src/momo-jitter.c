@@ -0,0 +1,194 @@
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include "../include/rtprofile.h"
+#include "../include/bench.h"
+
+/*
+  Tick jitter report: runs the same periodic loop as a motor tick (sleep to
+  an absolute deadline, then a little work) twice, first with the default
+  scheduling and then with the real-time profile of a role (MOMO_RT_PROFILE,
+  or -f), and compares how late each tick starts. Optional CPU hogs (-l),
+  which also write to a terminal-like sink, stand in for the inspector
+  rendering and the logging that compete with the motors on a loaded host.
+  The hogs and both runs are kept on the cores of the profile, so that the
+  runs differ by their scheduling only.
+  Run it on the host the profile is meant for: the difference is what
+  justifies the profile there.
+*/
+
+#define MAX_TICKS 10000000
+
+void printUsage();
+
+// Burns CPU on the cores of the profile and writes like a busy terminal,
+// until killed with its parent
+void runHog(struct rtProfile *profile) {
+  char frame[4096];
+  int fd = open("/dev/null", O_WRONLY);
+  volatile uint64_t sum = 0;
+
+  // (also when momo-jitter exits on an error)
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+  setRtAffinity(profile);
+  memset(frame, '=', sizeof(frame));
+  while (1) {
+    for (int i = 0; i < 1000000; i++) {
+      sum += i;
+    }
+    write(fd, frame, sizeof(frame));
+  }
+}
+
+// Runs the tick loop in a child process on the cores of the profile (with
+// the role's whole profile if role is not NULL) and stores the lateness of
+// every tick in samples
+// Returns the number of ticks
+int measureTicks(char *role, struct rtProfile *profile, long periodUs,
+    double seconds, uint64_t *samples) {
+  int ticks = seconds * 1000000 / periodUs;
+  pid_t pid;
+  int status;
+
+  if (ticks > MAX_TICKS) {
+    ticks = MAX_TICKS;
+  }
+
+  fflush(stdout);
+  pid = fork();
+  if (pid == 0) {
+    setRtAffinity(profile);
+    if (role != NULL && !applyRtProfile(role)) {
+      printf("momo-jitter: no settings for %s in %s\n", role,
+          getenv("MOMO_RT_PROFILE"));
+      exit(-1);
+    }
+
+    uint64_t deadline = nowNs();
+    for (int i = 0; i < ticks; i++) {
+      deadline += periodUs * 1000;
+      sleepUntilNs(deadline);
+      samples[i] = nowNs() - deadline;
+    }
+    exit(0);
+  }
+
+  if (pid == -1 || waitpid(pid, &status, 0) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("momo-jitter fork");
+    exit(-1);
+  }
+  // (a child exiting on an error has said why already)
+  if (WIFSIGNALED(status)) {
+    printf("momo-jitter: the %s run was killed by signal %d (%s)\n",
+        role != NULL ? "profile" : "default", WTERMSIG(status),
+        strsignal(WTERMSIG(status)));
+    exit(-1);
+  } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    exit(-1);
+  }
+
+  return ticks;
+}
+
+int main (int argc, char** argv) {
+  char *role = "motorx";
+  long periodUs = 1000;
+  double seconds = 5;
+  int hogs = 0;
+  pid_t hogPids[64];
+  struct rtProfile profile;
+  int option;
+
+  while ((option = getopt(argc, argv, "r:p:t:l:f:h")) != -1) {
+    switch (option) {
+      case 'r':
+        role = optarg;
+        break;
+      case 'p':
+        periodUs = atol(optarg);
+        break;
+      case 't':
+        seconds = atof(optarg);
+        break;
+      case 'l':
+        hogs = atoi(optarg);
+        break;
+      case 'f':
+        setenv("MOMO_RT_PROFILE", optarg, 1);
+        break;
+      default:
+        printUsage();
+        exit(option == 'h' ? 0 : -1);
+    }
+  }
+  if (periodUs <= 0 || seconds <= 0 || hogs < 0 || hogs > 64 ||
+      getenv("MOMO_RT_PROFILE") == NULL) {
+    printUsage();
+    exit(-1);
+  }
+
+  fdlog_info = openInfoLog();
+  fdlog_err = openErrorLog();
+
+  if (!readRtProfile(getenv("MOMO_RT_PROFILE"), role, &profile)) {
+    printf("momo-jitter: no settings for %s in %s\n", role,
+        getenv("MOMO_RT_PROFILE"));
+    exit(-1);
+  }
+
+  // shared with the measuring children
+  uint64_t *samples = mmap(NULL, MAX_TICKS * sizeof(uint64_t),
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (samples == MAP_FAILED) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("momo-jitter mmap");
+    exit(-1);
+  }
+
+  printf("momo-jitter: %ld us ticks for %.1f s, %d hogs, profile of %s from "
+      "%s\n", periodUs, seconds, hogs, role, getenv("MOMO_RT_PROFILE"));
+  fflush(stdout);
+  for (int i = 0; i < hogs; i++) {
+    if ((hogPids[i] = fork()) == 0) {
+      runHog(&profile);
+    }
+  }
+
+  int ticks = measureTicks(NULL, &profile, periodUs, seconds, samples);
+  printLatencySummary("default lateness", samples, ticks);
+  uint64_t defaultP99 = percentile(samples, ticks, 99);
+
+  ticks = measureTicks(role, &profile, periodUs, seconds, samples);
+  printLatencySummary("profile lateness", samples, ticks);
+  uint64_t profileP99 = percentile(samples, ticks, 99);
+
+  printf("p99 lateness %s %.1fx with the profile\n",
+      profileP99 <= defaultP99 ? "divided by" : "multiplied by",
+      profileP99 <= defaultP99 ?
+      (double) defaultP99 / (profileP99 ? profileP99 : 1) :
+      (double) profileP99 / (defaultP99 ? defaultP99 : 1));
+
+  for (int i = 0; i < hogs; i++) {
+    kill(hogPids[i], SIGKILL);
+    waitpid(hogPids[i], NULL, 0);
+  }
+  closeLog(fdlog_info);
+  closeLog(fdlog_err);
+  return 0;
+}
+
+void printUsage() {
+  printf("usage: momo-jitter [-f profile] [-r role] [-p period] [-t seconds] "
+      "[-l hogs]\n"
+      "  compares tick lateness with the default scheduling and with the\n"
+      "  real-time profile of a role (MOMO_RT_PROFILE, or -f)\n"
+      "  -r  role whose profile is used (default motorx)\n"
+      "  -p  tick period in microseconds (default 1000)\n"
+      "  -t  seconds per run (default 5)\n"
+      "  -l  CPU hogs competing with the ticks (default 0)\n");
+}
@@ -0,0 +1,233 @@
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+#include "../include/command.h"
+#include "../include/bench.h"
+
+/*
+  End-to-end latency benchmark: measures how long a velocity command takes
+  from the moment it is published on a motor's command ring to the moment it
+  shows up as a moved coordinate on the motor's inspector pipe (which is what
+  the inspector displays).
+  It runs a real motor process headless, inside a scratch directory with its
+  own tmp/ and logs/, and plays the part of the watchdog, the commander and
+  the inspector itself, so it needs no terminal and no running simulation.
+  Each probe is a velocity step large enough to stand out of the sensor noise,
+  followed (once observed) by a STOP that freezes the motor again.
+*/
+
+// probe velocity step: far beyond the +-0.5 sensor noise
+#define PROBE_STEP 40
+#define MAX_PROBES 1000000
+
+void printUsage();
+
+int main (int argc, char** argv) {
+  int probes = 200;
+  double probeRate = 2;
+  double loadRate = 0;
+  long simSpeed = SIM_SPEED;
+  char *axis = "x";
+  char *motorPath = NULL;
+  bool isKeeping = false;
+  char motorBinary[PATH_MAX];
+  char scratchDir[] = "/tmp/momo-latency-XXXXXX";
+  char simSpeedValue[32];
+  int option;
+
+  while ((option = getopt(argc, argv, "n:r:t:a:l:m:kh")) != -1) {
+    switch (option) {
+      case 'n':
+        probes = atoi(optarg);
+        break;
+      case 'r':
+        probeRate = atof(optarg);
+        break;
+      case 't':
+        simSpeed = atol(optarg);
+        break;
+      case 'a':
+        axis = optarg;
+        break;
+      case 'l':
+        loadRate = atof(optarg);
+        break;
+      case 'm':
+        motorPath = optarg;
+        break;
+      case 'k':
+        isKeeping = true;
+        break;
+      default:
+        printUsage();
+        exit(option == 'h' ? 0 : -1);
+    }
+  }
+
+  if (probes <= 0 || probes > MAX_PROBES || probeRate <= 0 || simSpeed <= 0 ||
+      loadRate < 0 || (strcmp(axis, "x") != 0 && strcmp(axis, "z") != 0)) {
+    printUsage();
+    exit(-1);
+  }
+
+  // locate the motor binary before leaving the repository directory
+  if (motorPath == NULL) {
+    motorPath = strcmp(axis, "x") == 0 ? "bin/motorx" : "bin/motorz";
+  }
+  if (realpath(motorPath, motorBinary) == NULL) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("momo-latency motor binary");
+    exit(-1);
+  }
+
+  // scratch directory: isolates our pipes and logs from a live simulation
+  if (mkdtemp(scratchDir) == NULL || chdir(scratchDir) == -1 ||
+      mkdir("tmp", 0777) == -1 || mkdir("logs", 0777) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("momo-latency scratch directory");
+    exit(-1);
+  }
+
+  fdlog_info = openInfoLog();
+  fdlog_err = openErrorLog();
+
+  sprintf(simSpeedValue, "%ld", simSpeed);
+  setenv("MOMO_SIM_SPEED", simSpeedValue, 1);
+
+  pid_t pid_motor = fork();
+  if (pid_motor == 0) {
+    char* arg_list[] = {motorBinary, NULL};
+    execv(motorBinary, arg_list);
+    perror("momo-latency motor exec");
+    exit(-1);
+  }
+
+  // motor boot handshake: we are its watchdog and its inspector
+  writePID("tmp/PID_watchdog", true);
+  readPID(strcmp(axis, "x") == 0 ? "tmp/PID_motorx" : "tmp/PID_motorz");
+  int fdInspector = openPipeMotorInspector(axis);
+  struct cmdChannel commands;
+  openMotorComm(&commands, axis, CMD_LANE_COMMANDER);
+
+  // wait for the motor's first tick
+  float coordinate = readCoordinates(fdInspector);
+
+  printf("momo-latency: axis %s, tick %ld us, %d probes at %.1f/s, "
+      "background load %.1f commands/s\n", axis, simSpeed, probes, probeRate,
+      loadRate);
+  fflush(stdout);
+
+  uint64_t *latencies = malloc(probes * sizeof(uint64_t));
+  uint64_t probePeriod = 1e9 / probeRate;
+  uint64_t loadPeriod = loadRate > 0 ? 1e9 / loadRate : 0;
+  uint64_t start = nowNs();
+  uint64_t nextProbe = start;
+  uint64_t nextLoad = start;
+  uint64_t sentAt = 0;
+  long updates = 0;
+  long loadCommands = 0;
+  int lateProbes = 0;
+  int done = 0;
+  bool isInFlight = false;
+  float base = 0;
+
+  while (done < probes) {
+    uint64_t now = nowNs();
+
+    if (!isInFlight && now >= nextProbe) {
+      // probe: step away from the current resting position
+      float step = base < 50 ? PROBE_STEP : -PROBE_STEP;
+      sentAt = nowNs();
+      commandMotor(&commands, step);
+      isInFlight = true;
+      if (now > nextProbe + probePeriod) {
+        // the previous probe took longer than the probe period
+        lateProbes++;
+        nextProbe = now;
+      }
+      nextProbe += probePeriod;
+    }
+
+    if (loadPeriod > 0 && now >= nextLoad) {
+      // background load: no-op velocity commands
+      commandMotor(&commands, 0);
+      loadCommands++;
+      nextLoad += loadPeriod;
+    }
+
+    // sleep until the next coordinate or the next command to send
+    uint64_t nextEvent = isInFlight ? UINT64_MAX : nextProbe;
+    if (loadPeriod > 0 && nextLoad < nextEvent) {
+      nextEvent = nextLoad;
+    }
+    now = nowNs();
+    uint64_t timeoutNs = nextEvent > now ? nextEvent - now : 0;
+    if (timeoutNs > 1000000000ull) {
+      timeoutNs = 1000000000ull;
+    }
+    struct timespec timeout = {timeoutNs / 1000000000ull,
+        timeoutNs % 1000000000ull};
+    struct pollfd pfd = {fdInspector, POLLIN, 0};
+
+    if (ppoll(&pfd, 1, &timeout, NULL) == -1 && errno != EINTR) {
+      printf("Error %d in ", errno);
+      fflush(stdout);
+      perror("momo-latency ppoll");
+      exit(-1);
+    }
+    if (!(pfd.revents & POLLIN)) {
+      continue;
+    }
+
+    coordinate = readCoordinates(fdInspector);
+    uint64_t observedAt = nowNs();
+    updates++;
+
+    if (isInFlight && fabs(coordinate - base) > PROBE_STEP / 2) {
+      latencies[done++] = observedAt - sentAt;
+      base += base < 50 ? PROBE_STEP : -PROBE_STEP;
+      isInFlight = false;
+      commandMotor(&commands, CMD_STOP);
+    }
+  }
+
+  double elapsed = (nowNs() - start) / 1e9;
+
+  commandMotor(&commands, CMD_SHUTDOWN);
+  waitpid(pid_motor, NULL, 0);
+  closeMotorComm(&commands);
+  closePipeMotorInspector(fdInspector);
+  closeLog(fdlog_info);
+  closeLog(fdlog_err);
+
+  printLatencySummary("command-to-position", latencies, done);
+  printf("throughput: %.2f probes/s (%d late), %.2f coordinate updates/s, "
+      "%.2f background commands/s\n", done / elapsed, lateProbes,
+      updates / elapsed, loadCommands / elapsed);
+
+  if (isKeeping) {
+    printf("scratch directory kept: %s\n", scratchDir);
+  } else {
+    removeScratchDir(scratchDir);
+  }
+
+  free(latencies);
+  return 0;
+}
+
+void printUsage() {
+  printf("usage: momo-latency [-n probes] [-r probes/s] [-t tick_us] "
+      "[-a x|z] [-l load commands/s] [-m motor binary] [-k]\n"
+      "  -n  number of probe commands (default 200)\n"
+      "  -r  probe rate, at most one probe in flight (default 2/s)\n"
+      "  -t  motor tick period in microseconds (default SIM_SPEED)\n"
+      "  -a  axis to benchmark (default x)\n"
+      "  -l  background no-op commands per second (default 0)\n"
+      "  -m  motor binary (default bin/motorx or bin/motorz)\n"
+      "  -k  keep the scratch directory (tmp/ and logs/ of the run)\n");
+}
@@ -0,0 +1,211 @@
+#include <getopt.h>
+
+#include "../include/command.h"
+#include "../include/bench.h"
+
+/*
+  Synthetic command load generator: drives the motor command rings of a
+  running simulation (from its own lane, CMD_LANE_LOADGEN) at a configurable
+  rate and burst shape, axis mix and STOP/RESET ratio, then reports the rate
+  it achieved, the commands dropped (-d) or delayed by a full lane, and the
+  time spent blocked publishing them.
+  Run it from the momo directory while the simulation is running.
+*/
+
+#define SHAPE_CONSTANT 0
+#define SHAPE_POISSON 1
+
+struct axisLoad {
+  char *name;
+  struct cmdChannel channel;
+  long sent;
+  long velocity;
+  long stops;
+  long resets;
+  long dropped;
+  long delayed;
+  uint64_t blockedNs;
+  struct statsHistogram publishLatency;
+};
+
+volatile sig_atomic_t isInterrupted = false;
+
+void printUsage();
+
+void interruptHandler(int signum) {
+  isInterrupted = true;
+}
+
+// Publishes one command, counting whether it was dropped or delayed (a
+// delayed command is dropped at the end of the run)
+// Returns false if the command was dropped
+bool sendCommand(struct axisLoad *axis, float command, bool isDropping,
+    uint64_t end) {
+  uint64_t start = nowNs();
+
+  if (!tryPublishCommand(&axis->channel, command)) {
+    if (isDropping) {
+      axis->dropped++;
+      return false;
+    }
+    axis->delayed++;
+    while (!tryPublishCommand(&axis->channel, command)) {
+      if (isInterrupted || nowNs() >= end) {
+        axis->dropped++;
+        axis->blockedNs += nowNs() - start;
+        return false;
+      }
+      waitForLane(&axis->channel);
+    }
+    axis->blockedNs += nowNs() - start;
+  }
+
+  axis->sent++;
+  recordLatency(&axis->publishLatency, nowNs() - start);
+  return true;
+}
+
+int main (int argc, char** argv) {
+  double rate = 1000;
+  double duration = 10;
+  int burst = 1;
+  int shape = SHAPE_CONSTANT;
+  double xShare = 0.5;
+  double stopRatio = 0.01;
+  double resetRatio = 0;
+  bool isDropping = false;
+  struct axisLoad axes[2];
+  struct statsHistogram empty;
+  int option;
+
+  while ((option = getopt(argc, argv, "r:t:b:px:s:R:dh")) != -1) {
+    switch (option) {
+      case 'r':
+        rate = atof(optarg);
+        break;
+      case 't':
+        duration = atof(optarg);
+        break;
+      case 'b':
+        burst = atoi(optarg);
+        break;
+      case 'p':
+        shape = SHAPE_POISSON;
+        break;
+      case 'x':
+        xShare = atof(optarg);
+        break;
+      case 's':
+        stopRatio = atof(optarg);
+        break;
+      case 'R':
+        resetRatio = atof(optarg);
+        break;
+      case 'd':
+        isDropping = true;
+        break;
+      default:
+        printUsage();
+        exit(option == 'h' ? 0 : -1);
+    }
+  }
+  if (rate <= 0 || duration <= 0 || burst <= 0 || xShare < 0 || xShare > 1 ||
+      stopRatio < 0 || resetRatio < 0 || stopRatio + resetRatio > 1) {
+    printUsage();
+    exit(-1);
+  }
+
+  fdlog_info = openInfoLog();
+  fdlog_err = openErrorLog();
+  writeInfoLog(fdlog_info, "Loadgen: booting up...");
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = &interruptHandler;
+  sigaction(SIGINT, &sa, NULL);
+
+  memset(axes, 0, sizeof(axes));
+  memset(&empty, 0, sizeof(empty));
+  axes[0].name = "x";
+  axes[1].name = "z";
+  openMotorComm(&axes[0].channel, "x", CMD_LANE_LOADGEN);
+  openMotorComm(&axes[1].channel, "z", CMD_LANE_LOADGEN);
+
+  printf("momo-loadgen: %.0f commands/s for %.1f s, bursts of %d (%s), "
+      "x share %.2f, stop %.3f, reset %.3f, %s when a lane is full\n", rate,
+      duration, burst, shape == SHAPE_POISSON ? "poisson" : "constant",
+      xShare, stopRatio, resetRatio, isDropping ? "drop" : "block");
+  fflush(stdout);
+  writeInfoLog(fdlog_info, "Loadgen: running");
+
+  srand48(time(0));
+  uint64_t start = nowNs();
+  uint64_t end = start + duration * 1e9;
+  uint64_t nextBurst = start;
+  double burstPeriod = burst / rate * 1e9;
+
+  while (!isInterrupted && nowNs() < end) {
+    sleepUntilNs(nextBurst);
+
+    for (int i = 0; i < burst && !isInterrupted; i++) {
+      struct axisLoad *axis = &axes[drand48() < xShare ? 0 : 1];
+      double kind = drand48();
+
+      if (kind < resetRatio) {
+        axis->resets += sendCommand(axis, CMD_RESET, isDropping, end);
+      } else if (kind < resetRatio + stopRatio) {
+        axis->stops += sendCommand(axis, CMD_STOP, isDropping, end);
+      } else {
+        // same velocity steps as the commander keys
+        axis->velocity += sendCommand(axis, drand48() < 0.5 ? -1 : 1,
+            isDropping, end);
+      }
+    }
+
+    if (shape == SHAPE_POISSON) {
+      // exponential gaps between bursts: a Poisson arrival process
+      nextBurst += -log(1 - drand48()) * burstPeriod;
+    } else {
+      nextBurst += burstPeriod;
+    }
+  }
+
+  double elapsed = (nowNs() - start) / 1e9;
+  long sent = axes[0].sent + axes[1].sent;
+
+  printf("%-4s %9s %9s %7s %7s %9s %9s %11s %9s %9s %9s\n", "axis", "sent",
+      "velocity", "stop", "reset", "dropped", "delayed", "blocked ms",
+      "pub p50", "pub p99", "pub max");
+  for (int i = 0; i < 2; i++) {
+    struct axisLoad *axis = &axes[i];
+    printf("%-4s %9ld %9ld %7ld %7ld %9ld %9ld %11.1f %9.2f %9.2f %9.2f\n",
+        axis->name, axis->sent, axis->velocity, axis->stops, axis->resets,
+        axis->dropped, axis->delayed, axis->blockedNs / 1e6,
+        histogramPercentile(&axis->publishLatency, &empty, 50) / 1e3,
+        histogramPercentile(&axis->publishLatency, &empty, 99) / 1e3,
+        histogramPercentile(&axis->publishLatency, &empty, 100) / 1e3);
+  }
+  printf("achieved %.1f commands/s over %.2f s (target %.1f); publish "
+      "latencies in us\n", sent / elapsed, elapsed, rate);
+
+  writeInfoLog(fdlog_info, "Loadgen: done");
+  closeMotorComm(&axes[0].channel);
+  closeMotorComm(&axes[1].channel);
+  closeLog(fdlog_info);
+  closeLog(fdlog_err);
+
+  return 0;
+}
+
+void printUsage() {
+  printf("usage: momo-loadgen [-r rate] [-t seconds] [-b burst] [-p] "
+      "[-x share] [-s ratio] [-R ratio] [-d]\n"
+      "  -r  average commands per second (default 1000)\n"
+      "  -t  duration in seconds (default 10)\n"
+      "  -b  commands sent back to back in each burst (default 1)\n"
+      "  -p  Poisson burst arrivals instead of evenly spaced ones\n"
+      "  -x  share of the commands sent to motorx (default 0.5)\n"
+      "  -s  share of STOP commands (default 0.01)\n"
+      "  -R  share of RESET commands (default 0)\n"
+      "  -d  drop commands when a lane is full instead of blocking\n");
+}
@@ -0,0 +1,432 @@
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "../include/common.h"
+
+/*
+  Queries the MOMO logs by time range and component without scanning them
+  whole. The log is mmapped and split into blocks of about LOG_BLOCK_BYTES
+  (cut at line boundaries); a sidecar index (<log>.idx) stores, for every
+  block, its offset, the range of its timestamps and the set of components
+  that wrote to it. The index is brought up to date incrementally: only the
+  bytes appended since the last run are parsed.
+  A query binary searches the first block that can hold its start time, skips
+  the blocks its components never wrote to, and stops at the first block that
+  starts after its end time, so it only touches the blocks it prints.
+*/
+
+#define LOG_BLOCK_BYTES 65536
+#define LOG_COMPONENTS 31
+// bit for the components that did not fit in the index' table
+#define LOG_OTHER_COMPONENT (1u << 31)
+// writers take their timestamp before waiting for the log lock, so lines
+// can be out of order by a little: tolerated when looking for the end
+#define LOG_SKEW_SECONDS 5
+#define LOG_INDEX_MAGIC "MOMOIDX1"
+
+struct logIndexHeader {
+  char magic[8];
+  uint64_t inode;
+  uint64_t indexedBytes; // end of the last complete block
+  uint32_t blockCount;
+  uint32_t componentCount;
+  char components[LOG_COMPONENTS][24];
+};
+
+struct logBlock {
+  uint64_t offset;
+  int64_t minTime;
+  int64_t maxTime;
+  int64_t prefixMaxTime; // max timestamp of this and all previous blocks
+  uint32_t componentMask;
+  uint32_t lines;
+};
+
+struct logIndex {
+  struct logIndexHeader header;
+  struct logBlock *blocks;
+  int capacity;
+};
+
+void printUsage();
+
+// days since 1-1-1970 of a civil date (proleptic Gregorian calendar)
+int64_t daysFromCivil(int64_t year, int month, int day) {
+  year -= month <= 2;
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  int64_t yearOfEra = year - era * 400;
+  int64_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 +
+      dayOfYear;
+  return era * 146097 + dayOfEra - 719468;
+}
+
+// Parses "d-m-yyyy h:m:s" (no zero padding, as written by writeInfoLog)
+// into seconds of local civil time. Returns the number of characters read,
+// 0 if the text is not a timestamp
+int parseTimestamp(const char *text, const char *end, int64_t *seconds) {
+  int64_t fields[6] = {0, 0, 0, 0, 0, 0};
+  char separators[6] = {'-', '-', ' ', ':', ':', 0};
+  const char *p = text;
+
+  for (int i = 0; i < 6; i++) {
+    if (p >= end || *p < '0' || *p > '9') {
+      return 0;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+      fields[i] = fields[i] * 10 + (*p++ - '0');
+    }
+    if (separators[i] != 0) {
+      if (p >= end || *p != separators[i]) {
+        return 0;
+      }
+      p++;
+    }
+  }
+
+  *seconds = daysFromCivil(fields[2], fields[1], fields[0]) * 86400 +
+      fields[3] * 3600 + fields[4] * 60 + fields[5];
+  return p - text;
+}
+
+// Parses one log line "[timestamp] Component: message"
+// Returns false if the line does not start with a timestamp
+bool parseLine(const char *line, const char *end, int64_t *time,
+    const char **component, int *componentLength) {
+  int length;
+
+  if (line >= end || *line != '[' ||
+      (length = parseTimestamp(line + 1, end, time)) == 0 ||
+      line + length + 3 > end || line[length + 1] != ']') {
+    return false;
+  }
+
+  *component = line + length + 3;
+  *componentLength = 0;
+  while (*component + *componentLength < end &&
+      (*component)[*componentLength] != ':' &&
+      (*component)[*componentLength] != '\n' && *componentLength < 23) {
+    (*componentLength)++;
+  }
+
+  return true;
+}
+
+// Bit of the component in the index, adding it to the table if new
+uint32_t componentBit(struct logIndexHeader *header, const char *name,
+    int length, bool isAdding) {
+  for (int i = 0; i < header->componentCount; i++) {
+    if (strncmp(header->components[i], name, length) == 0 &&
+        header->components[i][length] == 0) {
+      return 1u << i;
+    }
+  }
+  if (!isAdding) {
+    return 0;
+  }
+  if (header->componentCount == LOG_COMPONENTS) {
+    return LOG_OTHER_COMPONENT;
+  }
+
+  memcpy(header->components[header->componentCount], name, length);
+  header->components[header->componentCount][length] = 0;
+  return 1u << header->componentCount++;
+}
+
+void appendBlock(struct logIndex *index, struct logBlock *block) {
+  if (index->header.blockCount == index->capacity) {
+    index->capacity = index->capacity ? index->capacity * 2 : 1024;
+    index->blocks = realloc(index->blocks,
+        index->capacity * sizeof(struct logBlock));
+  }
+  index->blocks[index->header.blockCount++] = *block;
+}
+
+// Indexes the log from the end of the last indexed block, adding every
+// complete block. Returns the first block index that was added
+int updateIndex(struct logIndex *index, const char *log, uint64_t size) {
+  int firstNew = index->header.blockCount;
+  uint64_t offset = index->header.indexedBytes;
+  int64_t prefixMax = firstNew > 0 ?
+      index->blocks[firstNew - 1].prefixMaxTime : INT64_MIN;
+
+  while (offset < size) {
+    struct logBlock block = {offset, INT64_MAX, INT64_MIN, 0, 0, 0};
+    uint64_t blockEnd = offset;
+
+    // cut the block at the first line end past LOG_BLOCK_BYTES
+    while (blockEnd < size && blockEnd - offset < LOG_BLOCK_BYTES) {
+      const char *newline = memchr(log + blockEnd, '\n', size - blockEnd);
+      if (newline == NULL) {
+        // incomplete last line: wait for the writer to finish it
+        return firstNew;
+      }
+
+      const char *component;
+      int componentLength;
+      int64_t time;
+      if (parseLine(log + blockEnd, newline, &time, &component,
+          &componentLength)) {
+        block.minTime = time < block.minTime ? time : block.minTime;
+        block.maxTime = time > block.maxTime ? time : block.maxTime;
+        block.componentMask |= componentBit(&index->header, component,
+            componentLength, true);
+      }
+      block.lines++;
+      blockEnd = newline - log + 1;
+    }
+    if (blockEnd - offset < LOG_BLOCK_BYTES) {
+      // partial block at the end of the log: scanned at query time instead
+      return firstNew;
+    }
+
+    prefixMax = block.maxTime > prefixMax ? block.maxTime : prefixMax;
+    block.prefixMaxTime = prefixMax;
+    appendBlock(index, &block);
+    offset = blockEnd;
+    index->header.indexedBytes = offset;
+  }
+
+  return firstNew;
+}
+
+// Loads the sidecar index, or starts a new one if it is missing or belongs
+// to another file (e.g. the log was deleted and created again)
+void loadIndex(struct logIndex *index, char *indexPath, struct stat *logInfo) {
+  int fd = open(indexPath, O_RDONLY);
+
+  memset(index, 0, sizeof(struct logIndex));
+  if (fd != -1) {
+    if (read(fd, &index->header, sizeof(index->header)) ==
+        sizeof(index->header) &&
+        memcmp(index->header.magic, LOG_INDEX_MAGIC, 8) == 0 &&
+        index->header.inode == logInfo->st_ino &&
+        index->header.indexedBytes <= logInfo->st_size) {
+      index->capacity = index->header.blockCount;
+      index->blocks = malloc((index->capacity + 1) * sizeof(struct logBlock));
+      if (read(fd, index->blocks, index->header.blockCount *
+          sizeof(struct logBlock)) == index->header.blockCount *
+          sizeof(struct logBlock)) {
+        close(fd);
+        return;
+      }
+      free(index->blocks);
+    }
+    close(fd);
+  }
+
+  memset(index, 0, sizeof(struct logIndex));
+  memcpy(index->header.magic, LOG_INDEX_MAGIC, 8);
+  index->header.inode = logInfo->st_ino;
+}
+
+// Appends the new blocks and rewrites the header
+void saveIndex(struct logIndex *index, char *indexPath, int firstNew) {
+  int fd = open(indexPath, O_WRONLY | O_CREAT, 0666);
+
+  if (fd == -1 ||
+      (firstNew == 0 && ftruncate(fd, 0) == -1) ||
+      pwrite(fd, index->blocks + firstNew, (index->header.blockCount -
+      firstNew) * sizeof(struct logBlock), sizeof(index->header) +
+      firstNew * sizeof(struct logBlock)) == -1 ||
+      pwrite(fd, &index->header, sizeof(index->header), 0) == -1) {
+    // the index is only a cache: queries still work without it
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("momo-log index write");
+  }
+  if (fd != -1) {
+    close(fd);
+  }
+}
+
+// Scans [from, to) of the log, printing (or counting) the matching lines
+// Returns true once a line starting after the end time has been found
+bool scanLines(const char *log, uint64_t from, uint64_t to, int64_t start,
+    int64_t end, char *only, char *pattern, bool isCounting, long *matches) {
+  const char *line = log + from;
+  const char *stop = log + to;
+
+  while (line < stop) {
+    const char *newline = memchr(line, '\n', stop - line);
+    const char *lineEnd = newline != NULL ? newline + 1 : stop;
+    const char *component;
+    int componentLength;
+    int64_t time;
+
+    if (parseLine(line, lineEnd, &time, &component, &componentLength)) {
+      if (time - LOG_SKEW_SECONDS > end) {
+        return true;
+      }
+      if (time >= start && time <= end &&
+          (only == NULL || (strncmp(only, component, componentLength) == 0 &&
+          only[componentLength] == 0)) &&
+          (pattern == NULL || memmem(line, lineEnd - line, pattern,
+          strlen(pattern)) != NULL)) {
+        (*matches)++;
+        if (!isCounting) {
+          fwrite(line, 1, lineEnd - line, stdout);
+        }
+      }
+    }
+    line = lineEnd;
+  }
+
+  return false;
+}
+
+int main (int argc, char** argv) {
+  char *logPath = "logs/info.log";
+  char *component = NULL;
+  char *pattern = NULL;
+  int64_t start = INT64_MIN;
+  int64_t end = INT64_MAX;
+  bool isCounting = false;
+  bool isVerbose = false;
+  char indexPath[PATH_MAX];
+  struct logIndex index;
+  struct stat info;
+  int option;
+  int fd;
+
+  while ((option = getopt(argc, argv, "ef:F:T:c:g:nvh")) != -1) {
+    switch (option) {
+      case 'e':
+        logPath = "logs/errors.log";
+        break;
+      case 'f':
+        logPath = optarg;
+        break;
+      case 'F':
+      case 'T':
+        if (parseTimestamp(optarg, optarg + strlen(optarg),
+            option == 'F' ? &start : &end) == 0) {
+          printf("momo-log: bad timestamp \"%s\" (expected d-m-yyyy h:m:s)\n",
+              optarg);
+          exit(-1);
+        }
+        break;
+      case 'c':
+        component = optarg;
+        break;
+      case 'g':
+        pattern = optarg;
+        break;
+      case 'n':
+        isCounting = true;
+        break;
+      case 'v':
+        isVerbose = true;
+        break;
+      default:
+        printUsage();
+        exit(option == 'h' ? 0 : -1);
+    }
+  }
+
+  fd = open(logPath, O_RDONLY);
+  if (fd == -1 || fstat(fd, &info) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("momo-log open");
+    exit(-1);
+  }
+  if (info.st_size == 0) {
+    return 0;
+  }
+
+  const char *log = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (log == MAP_FAILED) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("momo-log mmap");
+    exit(-1);
+  }
+  // sequential when indexing, random when querying: let the kernel decide
+  madvise((void *) log, info.st_size, MADV_NORMAL);
+
+  snprintf(indexPath, sizeof(indexPath), "%s.idx", logPath);
+  loadIndex(&index, indexPath, &info);
+  uint64_t indexedBefore = index.header.indexedBytes;
+  int firstNew = updateIndex(&index, log, info.st_size);
+  if (firstNew < index.header.blockCount || firstNew == 0) {
+    saveIndex(&index, indexPath, firstNew);
+  }
+
+  uint32_t mask = 0;
+  if (component != NULL) {
+    // a component missing from a table that is not full never wrote to
+    // the indexed blocks (only the other bit, never set, then matches)
+    mask = componentBit(&index.header, component, strlen(component), false);
+    if (mask == 0) {
+      mask = LOG_OTHER_COMPONENT;
+    }
+  }
+
+  // first block that may contain a line at or after the start time
+  int low = 0;
+  int high = index.header.blockCount;
+  while (low < high) {
+    int middle = (low + high) / 2;
+    if (index.blocks[middle].prefixMaxTime < start) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  long matches = 0;
+  int blocksRead = 0;
+  bool isDone = false;
+  for (int i = low; i < index.header.blockCount && !isDone; i++) {
+    struct logBlock *block = &index.blocks[i];
+
+    if (block->minTime - LOG_SKEW_SECONDS > end) {
+      isDone = true;
+    } else if ((mask == 0 || (block->componentMask & mask) != 0) &&
+        block->maxTime >= start) {
+      uint64_t blockEnd = i + 1 < index.header.blockCount ?
+          index.blocks[i + 1].offset : index.header.indexedBytes;
+      isDone = scanLines(log, block->offset, blockEnd, start, end,
+          component, pattern, isCounting, &matches);
+      blocksRead++;
+    }
+  }
+  if (!isDone) {
+    // lines appended after the last complete block
+    scanLines(log, index.header.indexedBytes, info.st_size, start, end,
+        component, pattern, isCounting, &matches);
+  }
+
+  if (isCounting) {
+    printf("%ld\n", matches);
+  }
+  if (isVerbose) {
+    fprintf(stderr, "momo-log: %s, %ld bytes, %u blocks (%lu bytes newly "
+        "indexed), %d blocks scanned, %ld matching lines\n", logPath,
+        (long) info.st_size, index.header.blockCount,
+        (unsigned long) (index.header.indexedBytes - indexedBefore),
+        blocksRead, matches);
+  }
+
+  munmap((void *) log, info.st_size);
+  close(fd);
+  free(index.blocks);
+  return 0;
+}
+
+void printUsage() {
+  printf("usage: momo-log [-e | -f log] [-F from] [-T to] [-c component] "
+      "[-g text] [-n] [-v]\n"
+      "  prints the log lines in the time range (timestamps as in the log,\n"
+      "  e.g. -F \"19-10-2026 9:30:0\"), updating the sidecar index <log>.idx\n"
+      "  -e  query logs/errors.log instead of logs/info.log\n"
+      "  -f  query another log file\n"
+      "  -c  only lines of this component (Motor, Inspector, Watchdog, ...)\n"
+      "  -g  only lines containing this text\n"
+      "  -n  only print the number of matching lines\n"
+      "  -v  print index statistics on stderr\n");
+}
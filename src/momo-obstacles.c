@@ -0,0 +1,256 @@
+#include <getopt.h>
+
+#include "../include/obstacles.h"
+#include "../include/bench.h"
+
+/*
+  Obstacle map check and benchmark: compiles the map (MOMO_OBSTACLES, or -f)
+  at each grid spacing given, then times clearance checks at random points
+  of the workspace: a distance field lookup, the motors' step check (two
+  lookups), and for comparison the geometric test against every obstacle.
+  Random points miss the cache at fine spacings; points along a hook path,
+  like the motors' successive checks, are also timed.
+  It also reports how far the field is from the exact distances, drives
+  both axes at once toward every obstacle the way the motors do, failing if
+  the hook gets closer than the stop clearance allows, and with -m draws the
+  map.
+*/
+
+#define DEFAULT_SPACINGS "0.5,0.25,0.1,0.05"
+// approaches per obstacle, from evenly spread directions
+#define APPROACH_DIRECTIONS 16
+// ticks after which an approach that did not stop is given up
+#define APPROACH_TICKS 10000
+
+void printUsage();
+
+// Draws the field, one character per 2 x 4 track units
+void drawField(struct obstacleField *field) {
+  for (float z = 0; z <= MAX_Z; z += 4) {
+    for (float x = 0; x <= MAX_X; x += 2) {
+      float clearance = obstacleClearance(field, x, z);
+      putchar(clearance == 0 ? '#' : clearance < OBSTACLE_STOP ? '+' :
+          clearance < OBSTACLE_SLOW ? '.' : ' ');
+    }
+    putchar('\n');
+  }
+  printf("# obstacle, + stop, . slow down\n");
+}
+
+// Closest the hook gets to an obstacle, over the path from (x, z) to
+// (x + dx, z + dz) (sampled every tenth of a unit)
+float closestOnStep(struct obstacle *obstacle, float x, float z, float dx,
+    float dz) {
+  int samples = ceilf(hypotf(dx, dz) * 10) + 1;
+  float closest = INFINITY;
+
+  for (int i = 0; i <= samples; i++) {
+    closest = fminf(closest, shapeDistance(obstacle,
+        x + dx * i / samples, z + dz * i / samples));
+  }
+
+  return closest;
+}
+
+// Drives both axes toward every obstacle at the given speed per tick (of
+// the faster axis), both motors checking their step with the other one's
+// speed at the same tick like obstacleStep does, until the hook stops
+// Returns the closest the hook got to the obstacle approached
+float checkApproaches(struct obstacleMap *map, struct obstacleField *field,
+    float speed) {
+  float closest = INFINITY;
+
+  for (int i = 0; i < map->count; i++) {
+    struct obstacle *obstacle = &map->obstacles[i];
+    float centerX = obstacle->isCircle ? obstacle->x1 :
+        (obstacle->x1 + obstacle->x2) / 2;
+    float centerZ = obstacle->isCircle ? obstacle->z1 :
+        (obstacle->z1 + obstacle->z2) / 2;
+    float size = obstacle->isCircle ? obstacle->x2 :
+        hypotf(obstacle->x2 - obstacle->x1, obstacle->z2 - obstacle->z1) / 2;
+
+    for (int j = 0; j < APPROACH_DIRECTIONS; j++) {
+      float angle = 2 * M_PI * j / APPROACH_DIRECTIONS;
+      float distance = size + OBSTACLE_SLOW + speed;
+      float x = centerX + distance * cosf(angle);
+      float z = centerZ + distance * sinf(angle);
+      float scale = speed / fmaxf(fabsf(cosf(angle)), fabsf(sinf(angle)));
+      float speedX = -cosf(angle) * scale;
+      float speedZ = -sinf(angle) * scale;
+
+      // (from free points of the workspace only)
+      if (x < 0 || x > MAX_X || z < 0 || z > MAX_Z ||
+          obstacleClearance(field, x, z) < OBSTACLE_SLOW) {
+        continue;
+      }
+
+      for (int tick = 0; tick < APPROACH_TICKS &&
+          (speedX != 0 || speedZ != 0); tick++) {
+        // (both motors check from where the hook was at the last tick)
+        float fractionX = obstacleStepFraction(field, x, z, speedX, speedZ);
+        float fractionZ = obstacleStepFraction(field, x, z, speedX, speedZ);
+        float stepX = speedX * fractionX;
+        float stepZ = speedZ * fractionZ;
+
+        closest = fminf(closest, closestOnStep(obstacle, x, z, stepX, stepZ));
+        x += stepX;
+        z += stepZ;
+        speedX = fractionX == 0 ? 0 : speedX;
+        speedZ = fractionZ == 0 ? 0 : speedZ;
+      }
+    }
+  }
+
+  return closest;
+}
+
+int main (int argc, char** argv) {
+  char *path = getenv("MOMO_OBSTACLES");
+  char spacings[256] = DEFAULT_SPACINGS;
+  long checks = 10000000;
+  bool isDrawing = false;
+  bool isTooClose = false;
+  struct obstacleMap *map;
+  int option;
+
+  while ((option = getopt(argc, argv, "f:r:n:mh")) != -1) {
+    switch (option) {
+      case 'f':
+        path = optarg;
+        break;
+      case 'r':
+        snprintf(spacings, sizeof(spacings), "%s", optarg);
+        break;
+      case 'n':
+        checks = atol(optarg);
+        break;
+      case 'm':
+        isDrawing = true;
+        break;
+      default:
+        printUsage();
+        exit(option == 'h' ? 0 : -1);
+    }
+  }
+  if (path == NULL || checks <= 0) {
+    printUsage();
+    exit(-1);
+  }
+
+  fdlog_info = openInfoLog();
+  fdlog_err = openErrorLog();
+
+  map = malloc(sizeof(struct obstacleMap));
+  readObstacleMap(path, map);
+  printf("momo-obstacles: %d obstacles in %s, %ld checks per test\n",
+      map->count, path, checks);
+
+  // random points and a path sweeping the workspace, the same for every
+  // test (and kept out of the timings)
+  float *points = malloc(2 * checks * sizeof(float));
+  float *sweep = malloc(2 * checks * sizeof(float));
+  srand(1);
+  for (long i = 0; i < 2 * checks; i += 2) {
+    points[i] = (float) rand() / RAND_MAX * MAX_X;
+    points[i + 1] = (float) rand() / RAND_MAX * MAX_Z;
+    sweep[i] = fmod(i * 0.005, MAX_X);
+    sweep[i + 1] = MAX_Z * (0.5 + 0.45 * sin(i * 1e-6));
+  }
+
+  char *save;
+  for (char *spacing = strtok_r(spacings, ",", &save); spacing != NULL;
+      spacing = strtok_r(NULL, ",", &save)) {
+    struct obstacleField field;
+    volatile float sink = 0;
+    float maxError = 0;
+    uint64_t start;
+
+    map->cell = atof(spacing);
+    if (map->cell < 0.01f || map->cell >= OBSTACLE_MAX_CELL) {
+      printf("momo-obstacles: bad grid spacing %s\n", spacing);
+      exit(-1);
+    }
+
+    start = nowNs();
+    compileObstacleField(map, &field);
+    double compileMs = (nowNs() - start) / 1e6;
+    printf("\ngrid spacing %g: %dx%d points, %.1f MB, compiled in %.1f ms\n",
+        map->cell, field.columns, field.rows,
+        (double) field.columns * field.rows * sizeof(float) / 1048576,
+        compileMs);
+
+    start = nowNs();
+    for (long i = 0; i < 2 * checks; i += 2) {
+      sink += obstacleClearance(&field, points[i], points[i + 1]);
+    }
+    double lookupNs = (double) (nowNs() - start) / checks;
+
+    start = nowNs();
+    for (long i = 0; i < 2 * checks; i += 2) {
+      sink += obstacleClearance(&field, sweep[i], sweep[i + 1]);
+    }
+    double pathNs = (double) (nowNs() - start) / checks;
+
+    start = nowNs();
+    for (long i = 0; i < 2 * checks; i += 2) {
+      sink += obstacleStepFraction(&field, points[i], points[i + 1], 1, 0);
+    }
+    double stepNs = (double) (nowNs() - start) / checks;
+
+    // (fewer geometric tests: they are the slow ones)
+    long geometricChecks = checks / 10 > 0 ? checks / 10 : 1;
+    start = nowNs();
+    for (long i = 0; i < 2 * geometricChecks; i += 2) {
+      sink += obstacleDistance(map, points[i], points[i + 1]);
+    }
+    double geometricNs = (double) (nowNs() - start) / geometricChecks;
+
+    for (long i = 0; i < 2 * geometricChecks; i += 2) {
+      float error = fabsf(obstacleClearance(&field, points[i], points[i + 1]) -
+          obstacleDistance(map, points[i], points[i + 1]));
+      maxError = error > maxError ? error : maxError;
+    }
+
+    printf("  field lookup     %8.1f ns  %12.0f checks/s\n", lookupNs,
+        1e9 / lookupNs);
+    printf("  along a path     %8.1f ns  %12.0f checks/s\n", pathNs,
+        1e9 / pathNs);
+    printf("  motor step check %8.1f ns  %12.0f checks/s\n", stepNs,
+        1e9 / stepNs);
+    printf("  geometric test   %8.1f ns  %12.0f checks/s\n", geometricNs,
+        1e9 / geometricNs);
+    printf("  max error %.3f (bound: a cell diagonal, %.3f)\n", maxError,
+        map->cell * (float) M_SQRT2);
+
+    // (the stop clearance holds up to the field's error)
+    float closestSlow = checkApproaches(map, &field, 1);
+    float closestFast = checkApproaches(map, &field, 20);
+    bool isOk = fminf(closestSlow, closestFast) >=
+        OBSTACLE_STOP - map->cell * (float) M_SQRT2;
+    printf("  two-axis approach closest %.3f at speed 1, %.3f at speed 20: "
+        "%s\n", closestSlow, closestFast, isOk ? "ok" : "TOO CLOSE");
+    isTooClose |= !isOk;
+
+    if (isDrawing) {
+      drawField(&field);
+    }
+    free(field.clearance);
+  }
+
+  free(points);
+  free(sweep);
+  free(map);
+  closeLog(fdlog_info);
+  closeLog(fdlog_err);
+  return isTooClose ? -1 : 0;
+}
+
+void printUsage() {
+  printf("usage: momo-obstacles [-f map] [-r spacings] [-n checks] [-m]\n"
+      "  compiles the obstacle map (MOMO_OBSTACLES, or -f) into distance\n"
+      "  fields, benchmarks clearance checks against them and checks that\n"
+      "  the hook stops short of every obstacle\n"
+      "  -r  comma-separated grid spacings (default %s)\n"
+      "  -n  checks per test (default 10000000)\n"
+      "  -m  draw each field\n", DEFAULT_SPACINGS);
+}
@@ -0,0 +1,126 @@
+#include <getopt.h>
+
+#include "../include/common.h"
+
+/*
+  Samples the shared-memory metrics page (tmp/stats) at a fixed interval and
+  prints, like vmstat, one block per interval with the rates and latency
+  percentiles of every running MOMO process over that interval.
+*/
+
+void printUsage();
+void printHeader();
+void printProcess(int role, struct processStats *now,
+    struct processStats *before, double seconds);
+
+int main (int argc, char** argv) {
+  double interval = 1;
+  long count = -1;
+  int only = -1;
+  int option;
+
+  while ((option = getopt(argc, argv, "p:h")) != -1) {
+    switch (option) {
+      case 'p':
+        for (int i = 0; i < STATS_PROCESSES; i++) {
+          if (strcmp(optarg, statsNames[i]) == 0) {
+            only = i;
+          }
+        }
+        if (only == -1) {
+          printUsage();
+          exit(-1);
+        }
+        break;
+      default:
+        printUsage();
+        exit(option == 'h' ? 0 : -1);
+    }
+  }
+  if (optind < argc) {
+    interval = atof(argv[optind++]);
+  }
+  if (optind < argc) {
+    count = atol(argv[optind++]);
+  }
+  if (interval <= 0) {
+    printUsage();
+    exit(-1);
+  }
+
+  fdlog_info = openInfoLog();
+  fdlog_err = openErrorLog();
+
+  struct statsPage *page = mapStats();
+  struct statsPage before;
+  struct statsPage now;
+  uint64_t beforeNs = nowNs();
+
+  memcpy(&before, page, sizeof(before));
+
+  for (long sample = 0; count < 0 || sample < count; sample++) {
+    usleep(interval * 1000000);
+
+    uint64_t nowTime = nowNs();
+    memcpy(&now, page, sizeof(now));
+
+    printHeader();
+    for (int i = 0; i < STATS_PROCESSES; i++) {
+      if ((only == -1 || only == i) && now.processes[i].pid != 0) {
+        printProcess(i, &now.processes[i], &before.processes[i],
+            (nowTime - beforeNs) / 1e9);
+      }
+    }
+    printf("\n");
+    fflush(stdout);
+
+    before = now;
+    beforeNs = nowTime;
+  }
+
+  closeLog(fdlog_info);
+  closeLog(fdlog_err);
+  return 0;
+}
+
+void printHeader() {
+  printf("%-9s %7s %8s %9s %9s %8s %5s %5s %6s %7s %9s %9s\n", "process",
+      "pid", "ticks/s", "tick p50", "tick p99", "cmds/s", "depth", "max",
+      "eot/s", "logs/s", "log p50", "log p99");
+}
+
+void printProcess(int role, struct processStats *now,
+    struct processStats *before, double seconds) {
+  char pid[16];
+
+  // a new process in the slot restarts its counters
+  if (now->pid != before->pid) {
+    memset(before, 0, sizeof(struct processStats));
+  }
+
+  if (kill(now->pid, 0) == -1 && errno == ESRCH) {
+    sprintf(pid, "dead");
+  } else {
+    sprintf(pid, "%d", now->pid);
+  }
+
+  printf("%-9s %7s %8.1f %9.1f %9.1f %8.1f %5lu %5lu %6.1f %7.1f %9.1f %9.1f"
+      "\n", statsNames[role], pid,
+      (now->ticks - before->ticks) / seconds,
+      histogramPercentile(&now->tickDuration, &before->tickDuration, 50) / 1e3,
+      histogramPercentile(&now->tickDuration, &before->tickDuration, 99) / 1e3,
+      (now->commands - before->commands) / seconds,
+      (unsigned long) now->queueDepth, (unsigned long) now->maxQueueDepth,
+      (now->endOfTrack - before->endOfTrack) / seconds,
+      (now->logWrites - before->logWrites) / seconds,
+      histogramPercentile(&now->logLatency, &before->logLatency, 50) / 1e3,
+      histogramPercentile(&now->logLatency, &before->logLatency, 99) / 1e3);
+}
+
+void printUsage() {
+  printf("usage: momo-stat [-p process] [interval [count]]\n"
+      "  samples tmp/stats every interval seconds (default 1), count times\n"
+      "  (default forever); latencies are in microseconds\n"
+      "  -p  only show one process: watchdog, commander, inspector, motorx,\n"
+      "      motorz\n");
+}
@@ -0,0 +1,406 @@
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "../include/telemetry.h"
+
+/*
+  Telemetry fan-out server: serves the motors' position samples (see
+  telemetry.h) to any number of local observers connected to the Unix domain
+  socket tmp/telemetry.sock, one text line per sample:
+    <axis> <tick> <time in s> <position> <velocity>
+  A feeder thread sleeps on the telemetry futex and signals an eventfd; the
+  main thread multiplexes the eventfd, the listening socket and every
+  subscriber with epoll. Each subscriber has a bounded queue of lines: when a
+  slow subscriber lets it fill up, its oldest lines are dropped, so it never
+  delays the motors (which only write to shared memory) nor the other
+  subscribers (which are written to without blocking).
+  With -s, momo-telemetry subscribes instead and prints the lines.
+*/
+
+#define SOCKET_PATH "tmp/telemetry.sock"
+#define SUBSCRIBERS_MAX 1024
+#define QUEUE_LINES 256
+#define LINE_SIZE 64
+#define BATCH_SAMPLES 256
+// lines handed to the kernel per writev()
+#define WRITE_BATCH 64
+
+struct subscriber {
+  int fd;
+  char (*lines)[LINE_SIZE];
+  unsigned char *lengths;
+  uint64_t head; // next line to queue
+  uint64_t tail; // next line to write
+  int offset; // bytes of the tail line already written
+  char partial[LINE_SIZE]; // rest of a partly written line that was dropped
+  int partialLength;
+  bool isWaitingOutput; // EPOLLOUT requested
+  uint64_t sent;
+  uint64_t dropped;
+};
+
+struct subscriber *subscribers[SUBSCRIBERS_MAX];
+struct telemetryRing *telemetry;
+int epollFd;
+int eventFd;
+int queueLines = QUEUE_LINES;
+
+void printUsage();
+
+// Feeder thread: turns telemetry futex wakeups into eventfd events
+void *feedEvents(void *argument) {
+  uint32_t seen = atomic_load(&telemetry->wakeup);
+  uint64_t one = 1;
+
+  while (1) {
+    uint32_t wakeup = atomic_load(&telemetry->wakeup);
+    if (wakeup == seen) {
+      waitTelemetry(telemetry, wakeup);
+    } else {
+      seen = wakeup;
+      if (write(eventFd, &one, sizeof(one)) == -1) {
+        printf("Error %d in ", errno);
+        fflush(stdout);
+        perror("momo-telemetry eventfd write");
+        writeErrorLog(fdlog_err, "Telemetry: eventfd write failed");
+        exit(-1);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+void watchSubscriber(struct subscriber *subscriber, bool isWaitingOutput) {
+  struct epoll_event event;
+
+  event.events = EPOLLIN | EPOLLRDHUP | (isWaitingOutput ? EPOLLOUT : 0);
+  event.data.fd = subscriber->fd;
+  epoll_ctl(epollFd, EPOLL_CTL_MOD, subscriber->fd, &event);
+  subscriber->isWaitingOutput = isWaitingOutput;
+}
+
+void removeSubscriber(struct subscriber *subscriber) {
+  char message[128];
+
+  snprintf(message, sizeof(message), "Telemetry: subscriber left (%lu lines "
+      "sent, %lu dropped)", (unsigned long) subscriber->sent,
+      (unsigned long) subscriber->dropped);
+  writeInfoLog(fdlog_info, message);
+
+  // (closing also removes it from the epoll set)
+  close(subscriber->fd);
+  subscribers[subscriber->fd] = NULL;
+  free(subscriber->lines);
+  free(subscriber->lengths);
+  free(subscriber);
+}
+
+// Writes as much of the queue as the socket takes without blocking
+// Returns false if the subscriber was removed
+bool flushSubscriber(struct subscriber *subscriber) {
+  struct iovec vectors[WRITE_BATCH];
+
+  while (subscriber->partialLength > 0 ||
+      subscriber->tail < subscriber->head) {
+    int count = 0;
+    if (subscriber->partialLength > 0) {
+      vectors[count].iov_base = subscriber->partial;
+      vectors[count++].iov_len = subscriber->partialLength;
+    }
+    for (uint64_t line = subscriber->tail; line < subscriber->head &&
+        count < WRITE_BATCH; line++, count++) {
+      int offset = line == subscriber->tail ? subscriber->offset : 0;
+      vectors[count].iov_base = subscriber->lines[line % queueLines] + offset;
+      vectors[count].iov_len = subscriber->lengths[line % queueLines] - offset;
+    }
+
+    ssize_t written = writev(subscriber->fd, vectors, count);
+    if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (!subscriber->isWaitingOutput) {
+        watchSubscriber(subscriber, true);
+      }
+      return true;
+    } else if (written == -1) {
+      // gone (EPIPE, ECONNRESET...)
+      removeSubscriber(subscriber);
+      return false;
+    }
+
+    if (subscriber->partialLength > 0) {
+      int done = written < subscriber->partialLength ?
+          written : subscriber->partialLength;
+      memmove(subscriber->partial, subscriber->partial + done,
+          subscriber->partialLength - done);
+      subscriber->partialLength -= done;
+      written -= done;
+    }
+    // consume the whole lines written, and remember where a partial one ends
+    while (written > 0) {
+      int left = subscriber->lengths[subscriber->tail % queueLines] -
+          subscriber->offset;
+      if (written >= left) {
+        written -= left;
+        subscriber->offset = 0;
+        subscriber->tail++;
+        subscriber->sent++;
+      } else {
+        subscriber->offset += written;
+        written = 0;
+      }
+    }
+  }
+
+  if (subscriber->isWaitingOutput) {
+    watchSubscriber(subscriber, false);
+  }
+  return true;
+}
+
+// Queues a line, dropping the oldest one if the queue is full
+void queueLine(struct subscriber *subscriber, char *line, int length) {
+  if (subscriber->head - subscriber->tail == queueLines) {
+    if (subscriber->offset > 0) {
+      // a partly written line must be finished, or the stream would break:
+      // set its rest aside (the previous rest, if any, was sent already)
+      char *rest = subscriber->lines[subscriber->tail % queueLines] +
+          subscriber->offset;
+      subscriber->partialLength =
+          subscriber->lengths[subscriber->tail % queueLines] -
+          subscriber->offset;
+      memcpy(subscriber->partial, rest, subscriber->partialLength);
+      subscriber->offset = 0;
+      subscriber->sent++;
+    } else {
+      subscriber->dropped++;
+    }
+    subscriber->tail++;
+  }
+
+  memcpy(subscriber->lines[subscriber->head % queueLines], line, length);
+  subscriber->lengths[subscriber->head % queueLines] = length;
+  subscriber->head++;
+}
+
+void acceptSubscribers(int listenFd) {
+  struct epoll_event event;
+  int fd;
+
+  while ((fd = accept(listenFd, NULL, NULL)) != -1) {
+    if (fd >= SUBSCRIBERS_MAX) {
+      close(fd);
+      writeErrorLog(fdlog_err, "Telemetry: too many subscribers");
+      continue;
+    }
+
+    struct subscriber *subscriber = calloc(1, sizeof(struct subscriber));
+    subscriber->fd = fd;
+    subscriber->lines = malloc(queueLines * LINE_SIZE);
+    subscriber->lengths = malloc(queueLines);
+    subscribers[fd] = subscriber;
+
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = fd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    writeInfoLog(fdlog_info, "Telemetry: subscriber joined");
+  }
+}
+
+// Hands the new samples of both axes to every subscriber
+void fanOut(uint64_t cursors[], uint64_t *lost) {
+  struct telemetrySample samples[BATCH_SAMPLES];
+  char line[LINE_SIZE];
+  char *axisNames[TELEMETRY_AXES] = {"x", "z"};
+
+  for (int axis = 0; axis < TELEMETRY_AXES; axis++) {
+    int count;
+    while ((count = readTelemetry(telemetry, axis, &cursors[axis], samples,
+        BATCH_SAMPLES, lost)) > 0) {
+      for (int i = 0; i < count; i++) {
+        int length = snprintf(line, sizeof(line), "%s %u %.6f %.2f %.2f\n",
+            axisNames[axis], samples[i].tick, samples[i].timeNs / 1e9,
+            samples[i].position, samples[i].velocity);
+        for (int fd = 0; fd < SUBSCRIBERS_MAX; fd++) {
+          if (subscribers[fd] != NULL) {
+            queueLine(subscribers[fd], line, length);
+          }
+        }
+      }
+    }
+  }
+
+  for (int fd = 0; fd < SUBSCRIBERS_MAX; fd++) {
+    // (a subscriber waiting for EPOLLOUT is flushed when it gets it)
+    if (subscribers[fd] != NULL && !subscribers[fd]->isWaitingOutput) {
+      flushSubscriber(subscribers[fd]);
+    }
+  }
+}
+
+void serve() {
+  struct sockaddr_un address;
+  struct epoll_event event;
+  struct epoll_event events[64];
+  uint64_t cursors[TELEMETRY_AXES];
+  uint64_t lost = 0;
+  pthread_t feeder;
+  int listenFd;
+
+  telemetry = mapTelemetry();
+  // subscribers get the samples from now on
+  for (int axis = 0; axis < TELEMETRY_AXES; axis++) {
+    cursors[axis] = atomic_load(&telemetry->axes[axis].head);
+  }
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, SOCKET_PATH);
+  unlink(SOCKET_PATH);
+  listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (listenFd == -1 || eventFd == -1 || epollFd == -1 ||
+      bind(listenFd, (struct sockaddr *) &address, sizeof(address)) == -1 ||
+      listen(listenFd, 64) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("momo-telemetry socket");
+    writeErrorLog(fdlog_err, "Telemetry: serve socket setup failed");
+    exit(-1);
+  }
+
+  event.events = EPOLLIN;
+  event.data.fd = listenFd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+  event.data.fd = eventFd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, eventFd, &event);
+
+  if (pthread_create(&feeder, NULL, feedEvents, NULL) != 0) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("momo-telemetry pthread_create");
+    writeErrorLog(fdlog_err, "Telemetry: feeder thread creation failed");
+    exit(-1);
+  }
+
+  printf("momo-telemetry: serving on %s (%d lines per subscriber)\n",
+      SOCKET_PATH, queueLines);
+  fflush(stdout);
+  writeInfoLog(fdlog_info, "Telemetry: running");
+
+  while (1) {
+    int count = epoll_wait(epollFd, events, 64, -1);
+
+    for (int i = 0; i < count; i++) {
+      int fd = events[i].data.fd;
+
+      if (fd == listenFd) {
+        acceptSubscribers(listenFd);
+      } else if (fd == eventFd) {
+        uint64_t value;
+        read(eventFd, &value, sizeof(value));
+        fanOut(cursors, &lost);
+      } else if (subscribers[fd] != NULL) {
+        char discard[256];
+        if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+          removeSubscriber(subscribers[fd]);
+        } else if (events[i].events & EPOLLOUT) {
+          flushSubscriber(subscribers[fd]);
+        } else if (read(fd, discard, sizeof(discard)) == 0) {
+          // (subscribers have nothing to say)
+          removeSubscriber(subscribers[fd]);
+        }
+      }
+    }
+  }
+}
+
+// Prints the lines served by a running momo-telemetry, count of them (or
+// forever if count is negative)
+void subscribe(long count) {
+  struct sockaddr_un address;
+  char buffer[4096];
+  ssize_t length;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, SOCKET_PATH);
+  if (fd == -1 ||
+      connect(fd, (struct sockaddr *) &address, sizeof(address)) == -1) {
+    printf("Error %d in ", errno);
+    fflush(stdout);
+    perror("momo-telemetry connect");
+    exit(-1);
+  }
+
+  while (count != 0 && (length = read(fd, buffer, sizeof(buffer))) > 0) {
+    for (ssize_t i = 0; i < length && count != 0; i++) {
+      putchar(buffer[i]);
+      if (buffer[i] == '\n') {
+        count--;
+        fflush(stdout);
+      }
+    }
+  }
+  close(fd);
+}
+
+int main (int argc, char** argv) {
+  bool isSubscribing = false;
+  long count = -1;
+  int option;
+
+  while ((option = getopt(argc, argv, "q:sn:h")) != -1) {
+    switch (option) {
+      case 'q':
+        queueLines = atoi(optarg);
+        break;
+      case 's':
+        isSubscribing = true;
+        break;
+      case 'n':
+        count = atol(optarg);
+        break;
+      default:
+        printUsage();
+        exit(option == 'h' ? 0 : -1);
+    }
+  }
+  if (queueLines < 1) {
+    printUsage();
+    exit(-1);
+  }
+
+  fdlog_info = openInfoLog();
+  fdlog_err = openErrorLog();
+  // a subscriber that disconnects must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+
+  if (isSubscribing) {
+    subscribe(count);
+  } else {
+    writeInfoLog(fdlog_info, "Telemetry: booting up...");
+    serve();
+  }
+
+  closeLog(fdlog_info);
+  closeLog(fdlog_err);
+  return 0;
+}
+
+void printUsage() {
+  printf("usage: momo-telemetry [-q lines] | -s [-n count]\n"
+      "  serves the motor positions on %s, one line per sample:\n"
+      "  <axis> <tick> <time in s> <position> <velocity>\n"
+      "  -q  lines queued per subscriber before the oldest are dropped\n"
+      "      (default %d)\n"
+      "  -s  subscribe to a running server and print the lines\n"
+      "  -n  with -s, stop after count lines\n", SOCKET_PATH, QUEUE_LINES);
+}
@@ -1,4 +1,5 @@
 #include "../include/command.h"
+#include "../include/rtprofile.h"
 
 /*
   Monitors all processes (commander, inspector, motorx, motorz) and waits for a
@@ -17,12 +18,14 @@ bool isKiller = true;
 int main (int argc, char** argv) {
   struct sigaction sa;
   char* pipeNameInspector = "tmp/PID_inspector";
-  int fdlog_info;
-  int fdlog_err;
 
   fdlog_info = openInfoLog();
   fdlog_err = openErrorLog();
 
+  openStats(STATS_WATCHDOG);
+  openTrace("watchdog");
+  applyRtProfile("watchdog");
+
   writeInfoLog(fdlog_info, "Watchdog: booting up...");
 
   memset(&sa, 0, sizeof(sa));
@@ -50,6 +53,8 @@ int main (int argc, char** argv) {
     isKiller = true;
 
     sleep(RESET_TIME);
+    countStat(&stats->ticks, 1);
+    uint64_t traceScan = traceBegin();
 
     if (isKiller) {
       writeInfoLog(fdlog_info, "Watchdog: RESET signal sent");
@@ -57,6 +62,7 @@ int main (int argc, char** argv) {
       // fflush(stdout);
       kill(pid_inspector, SIGUSR1);
     }
+    traceEnd("watchdog scan", traceScan);
   }
 }
 
@@ -65,12 +71,14 @@ void signalHandler (int signum) {
     // printf("Watchdog: RESET signal interrupted\n");
     // fflush(stdout);
     isKiller = false;
+    countStat(&stats->heartbeats, 1);
   }
 
   if (signum == SIGUSR2) {
     // printf("Watchdog: RESET signal interrupted\n");
     // fflush(stdout);
     isKiller = false;
+    countStat(&stats->heartbeats, 1);
     writePID("tmp/PID_watchdog", false); // for motorx
     writePID("tmp/PID_watchdog", true); // for motorz
   }